@@ -0,0 +1,59 @@
+#include "alloc_counter.h"
+
+#include <esp_heap_caps.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<uint64_t> allocations{0};
+
+uint64_t host_allocations() {
+    return allocations.load(std::memory_order_relaxed);
+}
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size);
+}
+
+void* heap_caps_calloc(size_t count, size_t size, uint32_t caps) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return calloc(count, size);
+}
+
+void* heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
+
+void heap_caps_free(void* ptr) {
+    free(ptr);
+}
+
+void* operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    free(ptr);
+}
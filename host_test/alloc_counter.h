@@ -0,0 +1,10 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <cstdint>
+
+// Counts operator new and heap_caps_* calls of the host build, so the tests and the
+// benchmark can check that the per-frame paths do not allocate
+uint64_t host_allocations();
+
+#endif // ALLOC_COUNTER_H
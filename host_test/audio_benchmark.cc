@@ -0,0 +1,690 @@
+// Host benchmark of the audio pipeline pieces that build without ESP-IDF. Every stage
+// runs over a fixture in device-sized frames and reports the time per frame, the share
+// of real time and the allocations per frame. With --gate the run fails when a stage
+// allocates in steady state or is slower than its entry in the baseline file by more
+// than the tolerance. The checked-in baseline was taken on an x86-64 desktop, write one
+// for another machine with --update-baseline before comparing against it there.
+//
+// The Opus stages are only built when pkg-config finds libopus 1.5 or later, the UDP
+// crypt stages when mbedtls is installed. The AFE and
+// the codec are fakes that stand in for esp-sr and the I2S driver, so the capture and
+// playback path stages measure only the firmware's own buffering around them.
+//
+//   audio_benchmark [--wav speech.wav] [--gate] [--baseline file] [--tolerance 0.5]
+//                   [--update-baseline]
+#include "alloc_counter.h"
+#include "audio_fixture.h"
+#include "audio_kernels.h"
+#include "audio_mixer.h"
+#include "chunk_ring.h"
+#include "jitter_buffer.h"
+#include "json_writer.h"
+#include "packet_ring.h"
+#include "playback_ring.h"
+#include "polyphase_resampler.h"
+#if HOST_HAVE_OPUS
+#include "opus_codec.h"
+#endif
+#if HOST_HAVE_MBEDTLS
+#include <arpa/inet.h>
+#include <mbedtls/aes.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Frames of a stage are timed in batches and the fastest batch counts, so a preempted
+// batch does not fail the gate
+#define BENCHMARK_BATCHES 10
+#define BENCHMARK_BASELINE_RUNS 5
+#define BENCHMARK_GATE_RETRIES 3
+// Slowdowns smaller than this are timer noise for the stages that take well under a
+// microsecond per frame
+#define BENCHMARK_GATE_MIN_US 0.05
+
+static bool Regressed(double us_per_frame, double baseline_us, double tolerance) {
+    return us_per_frame > baseline_us * (1.0 + tolerance) && us_per_frame - baseline_us > BENCHMARK_GATE_MIN_US;
+}
+
+struct StageResult {
+    std::string name;
+    size_t frames;
+    double us_per_frame;
+    double realtime_percent;
+    double allocations_per_frame;
+    // Old implementation kept for comparison, not gated
+    bool reference = false;
+};
+
+// Runs frame(i) for every frame, the first warmup frames are not measured
+static StageResult Measure(const char* name, size_t frames, double frame_ms,
+    const std::function<void(size_t)>& frame) {
+    size_t warmup = std::min<size_t>(frames / 10 + 1, 10);
+    for (size_t i = 0; i < warmup; i++) {
+        frame(i);
+    }
+    size_t measured = frames - warmup;
+    size_t batch = std::max<size_t>(measured / BENCHMARK_BATCHES, 1);
+    auto allocations = host_allocations();
+    double best_us = -1;
+    for (size_t first = warmup; first < frames; first += batch) {
+        size_t last = std::min(first + batch, frames);
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = first; i < last; i++) {
+            frame(i);
+        }
+        double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        // A short last batch is only used if it is the only one
+        if (last - first == batch || best_us < 0) {
+            double per_frame = us / (last - first);
+            if (best_us < 0 || per_frame < best_us) {
+                best_us = per_frame;
+            }
+        }
+    }
+    auto frame_allocations = host_allocations() - allocations;
+    StageResult result;
+    result.name = name;
+    result.frames = measured;
+    result.us_per_frame = best_us;
+    result.realtime_percent = result.us_per_frame / (frame_ms * 10.0);
+    result.allocations_per_frame = (double)frame_allocations / measured;
+    return result;
+}
+
+// Stands in for an I2S codec: Read hands out the fixture interleaved with itself as the
+// reference channel, Write copies into a DMA sized buffer
+class FakeCodec {
+public:
+    FakeCodec(const AudioFixture& fixture, int channels, int dma_frames)
+        : fixture_(fixture), channels_(channels), dma_(dma_frames * channels) {}
+
+    int Read(int16_t* dest, int samples) {
+        for (int i = 0; i < samples; i += channels_) {
+            int16_t sample = fixture_.pcm[read_++ % fixture_.pcm.size()];
+            for (int channel = 0; channel < channels_; channel++) {
+                dest[i + channel] = sample;
+            }
+        }
+        return samples;
+    }
+
+    int Write(const int16_t* data, int samples) {
+        for (int offset = 0; offset < samples; offset += dma_.size()) {
+            int count = std::min<int>(dma_.size(), samples - offset);
+            memcpy(dma_.data(), data + offset, count * sizeof(int16_t));
+            checksum_ += dma_[0];
+        }
+        return samples;
+    }
+
+    inline int64_t checksum() const { return checksum_; }
+
+private:
+    const AudioFixture& fixture_;
+    int channels_;
+    size_t read_ = 0;
+    std::vector<int16_t> dma_;
+    int64_t checksum_ = 0;
+};
+
+static StageResult BenchmarkResampler(const AudioFixture& fixture, int output_rate) {
+    // 20 ms frames at the input rate
+    PolyphaseResampler resampler;
+    resampler.Configure(fixture.sample_rate, output_rate);
+    size_t frame = fixture.sample_rate / 50;
+    std::vector<int16_t> out(resampler.GetOutputSamples(frame));
+    char name[48];
+    snprintf(name, sizeof(name), "resample %d -> %d", fixture.sample_rate, output_rate);
+    return Measure(name, fixture.pcm.size() / frame, 20, [&](size_t i) {
+        resampler.Process(fixture.pcm.data() + i * frame, frame, out.data());
+    });
+}
+
+// 512 frame reads of the fixture taken as interleaved stereo, several passes since one
+// is too short to time
+static StageResult BenchmarkDeinterleave(const AudioFixture& fixture) {
+    size_t frames = 512;
+    std::vector<int16_t> left(frames), right(frames);
+    size_t reads = fixture.pcm.size() / (frames * 2);
+    return Measure("deinterleave stereo", reads * 20, frames * 1000.0 / fixture.sample_rate, [&](size_t i) {
+        auto stereo = fixture.pcm.data() + i % reads * frames * 2;
+        audio_kernels::DeinterleaveStereo(stereo, left.data(), right.data(), frames);
+    });
+}
+
+static StageResult BenchmarkInterleave(const AudioFixture& fixture) {
+    size_t frames = 512;
+    std::vector<int16_t> stereo(frames * 2);
+    size_t reads = fixture.pcm.size() / (frames * 2);
+    return Measure("interleave stereo", reads * 20, frames * 1000.0 / fixture.sample_rate, [&](size_t i) {
+        auto mono = fixture.pcm.data() + i % reads * frames * 2;
+        audio_kernels::InterleaveStereo(mono, mono + frames, stereo.data(), frames);
+    });
+}
+
+// The per-sample loop into fresh vectors InputAudio used before the kernels
+static StageResult BenchmarkDeinterleaveVectors(const AudioFixture& fixture) {
+    size_t frames = 512;
+    size_t reads = fixture.pcm.size() / (frames * 2);
+    int64_t checksum = 0;
+    auto result = Measure("deinterleave into vectors", reads * 20, frames * 1000.0 / fixture.sample_rate, [&](size_t i) {
+        auto stereo = fixture.pcm.data() + i % reads * frames * 2;
+        std::vector<int16_t> mic(frames), reference(frames);
+        for (size_t j = 0; j < frames; j++) {
+            mic[j] = stereo[j * 2];
+            reference[j] = stereo[j * 2 + 1];
+        }
+        checksum += mic[0] + reference[0];
+    });
+    result.reference = true;
+    return result;
+}
+
+static StageResult BenchmarkMixer(const AudioFixture& fixture) {
+    PlaybackRing speech, clip;
+    speech.Initialize(8192);
+    clip.Initialize(8192);
+    AudioMixer mixer;
+    mixer.Initialize(fixture.sample_rate);
+    mixer.AddVoice(&speech, 1.0f, true);
+    mixer.AddVoice(&clip, 1.0f, false);
+    size_t block = 512;
+    std::vector<int16_t> out(block);
+    size_t count = fixture.pcm.size() / block;
+    return Measure("mix speech + clip", count, block * 1000.0 / fixture.sample_rate, [&](size_t i) {
+        auto pcm = fixture.pcm.data() + i * block;
+        speech.Write(pcm, block);
+        if (i % 4 == 0) {
+            clip.Write(pcm, block);
+        }
+        mixer.Mix(out.data(), block);
+    });
+}
+
+static StageResult BenchmarkJitterBuffer() {
+    JitterBuffer buffer(60, 60, 600, 512);
+    std::vector<uint8_t> packet;
+    packet.reserve(512);
+    uint8_t data[160] = {};
+    size_t count = 20000;
+    return Measure("jitter buffer put + get", count, 60, [&](size_t i) {
+        // Every 8th pair arrives swapped
+        uint32_t sequence = i + 1;
+        if (i % 8 == 0) {
+            sequence++;
+        } else if (i % 8 == 1) {
+            sequence--;
+        }
+        buffer.Put(data, sizeof(data), sequence, i * 60);
+        buffer.Get(packet, i * 60);
+    });
+}
+
+// Downlink packets of 80 to 200 bytes arriving in bursts of five, with the C3 queue sizes
+static StageResult BenchmarkDecodeQueue() {
+    PacketRing queue(96, 512, 16 * 1024);
+    uint8_t data[200] = {};
+    size_t bytes = 0;
+    return Measure("decode queue push + pop", 20000, 60 * 5, [&](size_t i) {
+        for (int j = 0; j < 5; j++) {
+            queue.Push(data, 80 + (i * 5 + j) * 37 % 121, i * 5 + j + 1);
+        }
+        size_t size;
+        while (queue.Front(size) != nullptr) {
+            bytes += size;
+            queue.Pop();
+        }
+    });
+}
+
+// The list of vectors under the main loop mutex the decode queue replaced
+static StageResult BenchmarkDecodeQueueList() {
+    std::mutex mutex;
+    std::list<std::vector<uint8_t>> queue;
+    uint8_t data[200] = {};
+    size_t bytes = 0;
+    auto result = Measure("decode queue std::list", 20000, 60 * 5, [&](size_t i) {
+        for (int j = 0; j < 5; j++) {
+            // The protocol built a vector for every packet
+            std::vector<uint8_t> packet(data, data + 80 + (i * 5 + j) * 37 % 121);
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.emplace_back(std::move(packet));
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        while (!queue.empty()) {
+            auto packet = std::move(queue.front());
+            queue.pop_front();
+            bytes += packet.size();
+        }
+    });
+    result.reference = true;
+    return result;
+}
+
+static StageResult BenchmarkJsonWriter() {
+    std::string message;
+    std::string session_id = "9f3c1e2a-5b7d-4c8e-a1f0-2d6b8e4c7a90";
+    return Measure("json listen message", 100000, 60, [&](size_t) {
+        JsonWriter json(message, 128);
+        json.BeginObject().Field("session_id", session_id).Field("type", "listen")
+            .Field("state", "start").Field("mode", "auto").EndObject();
+    });
+}
+
+// The string concatenation SendStartListening used before the writer
+static StageResult BenchmarkJsonConcatenation() {
+    std::string session_id = "9f3c1e2a-5b7d-4c8e-a1f0-2d6b8e4c7a90";
+    size_t bytes = 0;
+    auto result = Measure("json listen concatenation", 100000, 60, [&](size_t) {
+        std::string message = "{\"session_id\":\"" + session_id + "\"";
+        message += ",\"type\":\"listen\",\"state\":\"start\"";
+        message += ",\"mode\":\"auto\"";
+        message += "}";
+        bytes += message.size();
+    });
+    result.reference = true;
+    return result;
+}
+
+// The vector AudioProcessor::Input appended to and erased each fed chunk from
+static StageResult BenchmarkAfeFeedVector(const AudioFixture& at16k) {
+    const size_t frame = 16000 / 1000 * 30;
+    const size_t chunk = 512;
+    std::vector<int16_t> buffer;
+    int64_t fed = 0;
+    size_t frames = at16k.pcm.size() / frame;
+    auto result = Measure("afe feed vector erase", frames * 20, 30, [&](size_t i) {
+        auto data = at16k.pcm.data() + i % frames * frame;
+        buffer.insert(buffer.end(), data, data + frame);
+        while (buffer.size() >= chunk) {
+            fed += buffer[0];
+            buffer.erase(buffer.begin(), buffer.begin() + chunk);
+        }
+    });
+    result.reference = true;
+    return result;
+}
+
+// The ESP32-S3 capture path: 32 ms of 24 kHz mic + reference from the codec, split,
+// brought to 16 kHz and fed to the AFE one 512 sample chunk per read
+static StageResult BenchmarkInputPath(const AudioFixture& at24k) {
+    const size_t frames = 24000 / 1000 * 32;
+    FakeCodec codec(at24k, 2, 256);
+    PolyphaseResampler mic_resampler, ref_resampler;
+    mic_resampler.Configure(24000, 16000);
+    ref_resampler.Configure(24000, 16000);
+    std::vector<int16_t> input(frames * 2), mic(frames), ref(frames);
+    std::vector<int16_t> mic16k(mic_resampler.GetOutputSamples(frames));
+    std::vector<int16_t> ref16k(ref_resampler.GetOutputSamples(frames));
+    std::vector<int16_t> resampled(mic16k.size() * 2);
+    ChunkRing feed;
+    feed.Initialize(512 * 2, 4);
+    int64_t fed = 0;
+    size_t count = at24k.pcm.size() / frames;
+    return Measure("input path (fake codec/afe)", count, 32, [&](size_t) {
+        codec.Read(input.data(), input.size());
+        audio_kernels::DeinterleaveStereo(input.data(), mic.data(), ref.data(), frames);
+        size_t resampled_frames = mic_resampler.Process(mic.data(), frames, mic16k.data());
+        ref_resampler.Process(ref.data(), frames, ref16k.data());
+        audio_kernels::InterleaveStereo(mic16k.data(), ref16k.data(), resampled.data(), resampled_frames);
+        // AudioFrontEnd::Feed, the fake AFE only reads the chunk
+        if (resampled_frames * 2 == feed.chunk_samples() && feed.size() == 0) {
+            fed += resampled[0];
+            return;
+        }
+        feed.Write(resampled.data(), resampled_frames * 2);
+        const int16_t* chunk;
+        while ((chunk = feed.Front()) != nullptr) {
+            fed += chunk[0];
+            feed.Pop();
+        }
+    });
+}
+
+// Capture frames that do not match the AFE feed chunk, 30 ms reads rebuffered into
+// 512 sample chunks, the fake AFE only reads them
+static StageResult BenchmarkAfeFeed(const AudioFixture& at16k) {
+    const size_t frame = 16000 / 1000 * 30;
+    ChunkRing feed;
+    feed.Initialize(512, 4);
+    int64_t fed = 0;
+    // Too fast to time over one pass of the fixture
+    size_t frames = at16k.pcm.size() / frame;
+    return Measure("afe feed (fake afe)", frames * 20, 30, [&](size_t i) {
+        feed.Write(at16k.pcm.data() + i % frames * frame, frame);
+        const int16_t* chunk;
+        while ((chunk = feed.Front()) != nullptr) {
+            fed += chunk[0];
+            feed.Pop();
+        }
+    });
+}
+
+// The downlink from the decode queue to the codec: jitter buffer, decode, playback ring
+// and the mixer writing one DMA buffer at a time. Without libopus the decode copies the
+// next 60 ms of the fixture instead.
+static StageResult BenchmarkOutputPath(const AudioFixture& at24k) {
+    const size_t frame = 24000 / 1000 * 60;
+    const size_t dma_frames = 240;
+    FakeCodec codec(at24k, 1, dma_frames);
+    JitterBuffer jitter_buffer(60, 60, 600, 512);
+    PlaybackRing ring;
+    ring.Initialize(frame * 4);
+    AudioMixer mixer;
+    mixer.Initialize(24000);
+    mixer.AddVoice(&ring, 1.0f, true);
+    std::vector<uint8_t> packet;
+    packet.reserve(512);
+    std::vector<int16_t> pcm(frame), out(dma_frames);
+    size_t count = at24k.pcm.size() / frame;
+#if HOST_HAVE_OPUS
+    // Packets encoded up front, the stage measures only the decode side
+    OpusUplinkEncoder encoder(24000, 1, 60);
+    std::vector<std::vector<uint8_t>> packets;
+    std::vector<int16_t> source(at24k.pcm.begin(), at24k.pcm.begin() + count * frame);
+    encoder.Encode(std::move(source), [&packets](const std::vector<uint8_t>& opus) {
+        packets.push_back(opus);
+    });
+    count = packets.size();
+    OpusDownlinkDecoder decoder(24000, 1);
+#else
+    uint8_t data[160] = {};
+    size_t next = 0;
+#endif
+    return Measure("output path (fake codec)", count, 60, [&](size_t i) {
+#if HOST_HAVE_OPUS
+        jitter_buffer.Put(packets[i].data(), packets[i].size(), i + 1, i * 60);
+#else
+        jitter_buffer.Put(data, sizeof(data), i + 1, i * 60);
+#endif
+        auto result = jitter_buffer.Get(packet, i * 60);
+        if (result == kJitterBufferPacket) {
+#if HOST_HAVE_OPUS
+            decoder.Decode(packet.data(), packet.size(), pcm);
+#else
+            memcpy(pcm.data(), at24k.pcm.data() + (next++ % count) * frame, frame * sizeof(int16_t));
+#endif
+            ring.Write(pcm.data(), pcm.size());
+        }
+        size_t samples;
+        while ((samples = mixer.Mix(out.data(), dma_frames)) > 0) {
+            codec.Write(out.data(), samples);
+        }
+    });
+}
+
+#if HOST_HAVE_OPUS
+static StageResult BenchmarkOpusEncode(const AudioFixture& at16k) {
+    const size_t frame = 16000 / 1000 * 60;
+    OpusUplinkEncoder encoder(16000, 1, 60);
+    std::vector<int16_t> pcm;
+    pcm.reserve(frame);
+    size_t bytes = 0;
+    size_t count = at16k.pcm.size() / frame;
+    return Measure("opus encode 16k 60 ms", count, 60, [&](size_t i) {
+        auto data = at16k.pcm.data() + i * frame;
+        pcm.assign(data, data + frame);
+        encoder.Encode(std::move(pcm), [&bytes](const std::vector<uint8_t>& opus) {
+            bytes += opus.size();
+        });
+    });
+}
+
+static StageResult BenchmarkOpusDecode(const AudioFixture& at24k) {
+    const size_t frame = 24000 / 1000 * 60;
+    OpusUplinkEncoder encoder(24000, 1, 60);
+    std::vector<std::vector<uint8_t>> packets;
+    std::vector<int16_t> source(at24k.pcm.begin(), at24k.pcm.begin() + at24k.pcm.size() / frame * frame);
+    encoder.Encode(std::move(source), [&packets](const std::vector<uint8_t>& opus) {
+        packets.push_back(opus);
+    });
+    OpusDownlinkDecoder decoder(24000, 1);
+    std::vector<int16_t> pcm(frame);
+    return Measure("opus decode 24k 60 ms", packets.size(), 60, [&](size_t i) {
+        decoder.Decode(packets[i].data(), packets[i].size(), pcm);
+    });
+}
+#endif
+
+static AudioFixture Resample(const AudioFixture& fixture, int sample_rate) {
+    AudioFixture result;
+    result.sample_rate = sample_rate;
+    PolyphaseResampler resampler;
+    resampler.Configure(fixture.sample_rate, sample_rate);
+    result.pcm.resize(resampler.GetOutputSamples(fixture.pcm.size()));
+    result.pcm.resize(resampler.Process(fixture.pcm.data(), fixture.pcm.size(), result.pcm.data()));
+    return result;
+}
+
+#if HOST_HAVE_MBEDTLS
+// MqttProtocol::SendAudio: the 16 byte header in front of the payload doubles as the
+// AES-CTR counter block, the payload is encrypted straight into a reused packet
+static StageResult BenchmarkUdpEncrypt() {
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    uint8_t key[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    mbedtls_aes_setkey_enc(&aes, key, 128);
+    std::string nonce(16, '\x01');
+    std::vector<uint8_t> opus(180, 0x5a);
+    std::string packet;
+    packet.reserve(16 + 1000);
+    uint32_t sequence = 0;
+    auto result = Measure("udp audio encrypt", 50000, 60, [&](size_t) {
+        packet.resize(16 + opus.size());
+        auto data = (uint8_t*)packet.data();
+        memcpy(data, nonce.data(), 16);
+        *(uint16_t*)&data[2] = htons(opus.size());
+        *(uint32_t*)&data[12] = htonl(++sequence);
+        uint8_t counter[16];
+        memcpy(counter, data, sizeof(counter));
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        mbedtls_aes_crypt_ctr(&aes, opus.size(), &nc_off, counter, stream_block, opus.data(), data + 16);
+    });
+    mbedtls_aes_free(&aes);
+    return result;
+}
+
+// The nonce and ciphertext strings SendAudio built for every packet before
+static StageResult BenchmarkUdpEncryptStrings() {
+    mbedtls_aes_context aes;
+    mbedtls_aes_init(&aes);
+    uint8_t key[16] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+    mbedtls_aes_setkey_enc(&aes, key, 128);
+    std::string aes_nonce(16, '\x01');
+    std::vector<uint8_t> opus(180, 0x5a);
+    uint32_t sequence = 0;
+    size_t bytes = 0;
+    auto result = Measure("udp audio encrypt strings", 50000, 60, [&](size_t) {
+        std::string nonce(aes_nonce);
+        *(uint16_t*)&nonce[2] = htons(opus.size());
+        *(uint32_t*)&nonce[12] = htonl(++sequence);
+        std::string encrypted;
+        encrypted.resize(aes_nonce.size() + opus.size());
+        memcpy(encrypted.data(), nonce.data(), nonce.size());
+        size_t nc_off = 0;
+        uint8_t stream_block[16] = {0};
+        mbedtls_aes_crypt_ctr(&aes, opus.size(), &nc_off, (uint8_t*)nonce.data(), stream_block,
+            opus.data(), (uint8_t*)&encrypted[nonce.size()]);
+        bytes += encrypted.size();
+    });
+    mbedtls_aes_free(&aes);
+    result.reference = true;
+    return result;
+}
+#endif
+
+// One "us_per_frame stage name" per line, # starts a comment
+static std::map<std::string, double> ReadBaseline(const std::string& path) {
+    std::map<std::string, double> baseline;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::istringstream fields(line);
+        double us;
+        std::string name;
+        if (fields >> us && std::getline(fields >> std::ws, name)) {
+            baseline[name] = us;
+        }
+    }
+    return baseline;
+}
+
+static bool WriteBaseline(const std::string& path, const std::vector<StageResult>& results) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    fprintf(file, "# us/frame per stage, written by audio_benchmark --update-baseline\n");
+    for (auto& result : results) {
+        fprintf(file, "%.3f %s\n", result.us_per_frame, result.name.c_str());
+    }
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string wav;
+    std::string baseline_path;
+    bool gate = false;
+    bool update_baseline = false;
+    double tolerance = 0.5;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc) {
+            wav = argv[++i];
+        } else if (strcmp(argv[i], "--gate") == 0) {
+            gate = true;
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_path = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--update-baseline") == 0) {
+            update_baseline = true;
+        } else {
+            fprintf(stderr, "Usage: %s [--wav file.wav] [--gate] [--baseline file] [--tolerance fraction] [--update-baseline]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (baseline_path.empty()) {
+        baseline_path = HOST_BENCHMARK_BASELINE;
+    }
+    AudioFixture fixture;
+    if (!wav.empty()) {
+        if (!ReadWav(wav, fixture)) {
+            fprintf(stderr, "Cannot read %s, 16-bit mono or stereo PCM expected\n", wav.c_str());
+            return 2;
+        }
+    } else {
+        fixture = GenerateSpeechLike(48000, 10.0);
+    }
+    printf("Fixture: %s, %d Hz, %.1f s\n", wav.empty() ? "generated speech" : wav.c_str(),
+        fixture.sample_rate, (double)fixture.pcm.size() / fixture.sample_rate);
+
+    // The capture and playback rates the boards use, and 44.1 kHz for recorded sources
+    auto at16k = Resample(fixture, 16000);
+    auto at24k = Resample(fixture, 24000);
+    auto at44k = Resample(fixture, 44100);
+
+    std::vector<std::function<StageResult()>> stages = {
+        [&]() { return BenchmarkResampler(fixture, 16000); },
+        [&]() { return BenchmarkResampler(at16k, 24000); },
+        [&]() { return BenchmarkResampler(at16k, 48000); },
+        [&]() { return BenchmarkResampler(at24k, 16000); },
+        [&]() { return BenchmarkResampler(at44k, 16000); },
+        [&]() { return BenchmarkDeinterleave(fixture); },
+        [&]() { return BenchmarkInterleave(fixture); },
+        [&]() { return BenchmarkDeinterleaveVectors(fixture); },
+        [&]() { return BenchmarkMixer(at16k); },
+        [&]() { return BenchmarkJitterBuffer(); },
+        [&]() { return BenchmarkDecodeQueue(); },
+        [&]() { return BenchmarkDecodeQueueList(); },
+        [&]() { return BenchmarkJsonWriter(); },
+        [&]() { return BenchmarkJsonConcatenation(); },
+        [&]() { return BenchmarkAfeFeed(at16k); },
+        [&]() { return BenchmarkAfeFeedVector(at16k); },
+        [&]() { return BenchmarkInputPath(at24k); },
+        [&]() { return BenchmarkOutputPath(at24k); },
+#if HOST_HAVE_OPUS
+        [&]() { return BenchmarkOpusEncode(at16k); },
+        [&]() { return BenchmarkOpusDecode(at24k); },
+#endif
+#if HOST_HAVE_MBEDTLS
+        [&]() { return BenchmarkUdpEncrypt(); },
+        [&]() { return BenchmarkUdpEncryptStrings(); },
+#endif
+    };
+
+    std::vector<StageResult> results;
+    for (auto& stage : stages) {
+        results.push_back(stage());
+    }
+    if (update_baseline) {
+        // The median of several runs, one lucky or preempted run does not set the bar
+        for (size_t i = 0; i < stages.size(); i++) {
+            std::vector<double> runs = { results[i].us_per_frame };
+            for (int run = 1; run < BENCHMARK_BASELINE_RUNS; run++) {
+                runs.push_back(stages[i]().us_per_frame);
+            }
+            std::sort(runs.begin(), runs.end());
+            results[i].us_per_frame = runs[runs.size() / 2];
+        }
+        if (!WriteBaseline(baseline_path, results)) {
+            fprintf(stderr, "Cannot write %s\n", baseline_path.c_str());
+            return 2;
+        }
+        printf("Baseline written to %s\n", baseline_path.c_str());
+    }
+    auto baseline = ReadBaseline(baseline_path);
+    if (gate) {
+        // A slow stage is measured again before it counts, the host clock speed varies
+        for (size_t i = 0; i < stages.size(); i++) {
+            auto entry = baseline.find(results[i].name);
+            for (int retry = 0; retry < BENCHMARK_GATE_RETRIES && !results[i].reference && entry != baseline.end() &&
+                Regressed(results[i].us_per_frame, entry->second, tolerance); retry++) {
+                auto result = stages[i]();
+                if (result.us_per_frame < results[i].us_per_frame) {
+                    results[i] = result;
+                }
+            }
+        }
+    }
+
+    int failures = 0;
+    printf("%-30s %8s %12s %12s %10s %12s\n", "stage", "frames", "us/frame", "baseline", "realtime", "allocs/frame");
+    for (auto& result : results) {
+        auto entry = baseline.find(result.name);
+        bool regressed = !result.reference && entry != baseline.end() &&
+            Regressed(result.us_per_frame, entry->second, tolerance);
+        bool allocates = !result.reference && result.allocations_per_frame > 0;
+        char reference[16] = "-";
+        if (entry != baseline.end()) {
+            snprintf(reference, sizeof(reference), "%.3f", entry->second);
+        }
+        printf("%-30s %8zu %12.3f %12s %9.3f%% %12.2f%s\n", result.name.c_str(), result.frames,
+            result.us_per_frame, reference, result.realtime_percent, result.allocations_per_frame,
+            result.reference ? "  (reference)" : regressed ? "  REGRESSED" : allocates ? "  ALLOCATES" : "");
+        if (regressed || allocates) {
+            failures++;
+        }
+    }
+    if (gate && failures > 0) {
+        fprintf(stderr, "%d stage(s) failed the gate, %.0f%% over %s allowed\n", failures, tolerance * 100,
+            baseline_path.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "audio_fixture.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+static int16_t Clamp16(double value) {
+    if (value > 32767.0) {
+        return 32767;
+    }
+    if (value < -32768.0) {
+        return -32768;
+    }
+    return (int16_t)std::lround(value);
+}
+
+AudioFixture GenerateTone(int sample_rate, double frequency, double seconds, double amplitude) {
+    AudioFixture fixture;
+    fixture.sample_rate = sample_rate;
+    fixture.pcm.resize((size_t)(sample_rate * seconds));
+    for (size_t i = 0; i < fixture.pcm.size(); i++) {
+        fixture.pcm[i] = Clamp16(32767.0 * amplitude * std::sin(2 * M_PI * frequency * i / sample_rate));
+    }
+    return fixture;
+}
+
+AudioFixture GenerateSpeechLike(int sample_rate, double seconds) {
+    AudioFixture fixture;
+    fixture.sample_rate = sample_rate;
+    fixture.pcm.resize((size_t)(sample_rate * seconds));
+    std::mt19937 random(1234);
+    std::normal_distribution<double> noise(0.0, 30.0);
+    double phase = 0;
+    for (size_t i = 0; i < fixture.pcm.size(); i++) {
+        double t = (double)i / sample_rate;
+        // 4 syllables per second, every fourth one is a pause
+        double syllable = std::fmod(t * 4, 4.0);
+        double envelope = syllable < 3.0 ? std::pow(std::sin(M_PI * std::fmod(syllable, 1.0)), 2) : 0.0;
+        double pitch = 140 + 40 * std::sin(2 * M_PI * 0.7 * t);
+        phase += 2 * M_PI * pitch / sample_rate;
+        double voice = 0;
+        for (int harmonic = 1; harmonic <= 20 && harmonic * pitch < sample_rate / 2; harmonic++) {
+            voice += std::sin(phase * harmonic) / harmonic;
+        }
+        fixture.pcm[i] = Clamp16(9000 * envelope * voice + noise(random));
+    }
+    return fixture;
+}
+
+bool ReadWav(const std::string& path, AudioFixture& fixture) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    char riff[12];
+    if (fread(riff, 1, 12, file) != 12 || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        fclose(file);
+        return false;
+    }
+    int channels = 0;
+    int bits = 0;
+    bool ok = false;
+    char chunk[8];
+    while (fread(chunk, 1, 8, file) == 8) {
+        uint32_t size;
+        memcpy(&size, chunk + 4, 4);
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            uint8_t format[16] = {};
+            if (size < 16 || fread(format, 1, 16, file) != 16) {
+                break;
+            }
+            channels = format[2] | format[3] << 8;
+            fixture.sample_rate = format[4] | format[5] << 8 | format[6] << 16 | format[7] << 24;
+            bits = format[14] | format[15] << 8;
+            fseek(file, size - 16 + (size & 1), SEEK_CUR);
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (bits != 16 || channels < 1 || channels > 2) {
+                break;
+            }
+            std::vector<int16_t> samples(size / 2);
+            size_t read = fread(samples.data(), 2, samples.size(), file);
+            fixture.pcm.resize(read / channels);
+            for (size_t i = 0; i < fixture.pcm.size(); i++) {
+                fixture.pcm[i] = channels == 1 ? samples[i] : (int16_t)((samples[i * 2] + samples[i * 2 + 1]) / 2);
+            }
+            ok = !fixture.pcm.empty();
+            break;
+        } else {
+            fseek(file, size + (size & 1), SEEK_CUR);
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+// Fits a * sin + b * cos to the signal, returns the fitted amplitude and the residual
+static void FitTone(const int16_t* pcm, size_t samples, int sample_rate, double frequency,
+    double& amplitude, double& residual_power) {
+    double ss = 0, cc = 0, sc = 0, xs = 0, xc = 0;
+    for (size_t i = 0; i < samples; i++) {
+        double w = 2 * M_PI * frequency * i / sample_rate;
+        double s = std::sin(w);
+        double c = std::cos(w);
+        ss += s * s;
+        cc += c * c;
+        sc += s * c;
+        xs += pcm[i] * s;
+        xc += pcm[i] * c;
+    }
+    double det = ss * cc - sc * sc;
+    double a = (xs * cc - xc * sc) / det;
+    double b = (xc * ss - xs * sc) / det;
+    amplitude = std::sqrt(a * a + b * b);
+    residual_power = 0;
+    for (size_t i = 0; i < samples; i++) {
+        double w = 2 * M_PI * frequency * i / sample_rate;
+        double error = pcm[i] - a * std::sin(w) - b * std::cos(w);
+        residual_power += error * error;
+    }
+    residual_power /= samples;
+}
+
+double ToneLevelDb(const int16_t* pcm, size_t samples, int sample_rate, double frequency) {
+    double amplitude, residual;
+    FitTone(pcm, samples, sample_rate, frequency, amplitude, residual);
+    return 20 * std::log10(std::max(amplitude, 1e-9) / 32767.0);
+}
+
+double ThdNDb(const int16_t* pcm, size_t samples, int sample_rate, double frequency) {
+    double amplitude, residual;
+    FitTone(pcm, samples, sample_rate, frequency, amplitude, residual);
+    double tone_power = amplitude * amplitude / 2;
+    return 10 * std::log10(std::max(residual, 1e-12) / tone_power);
+}
@@ -0,0 +1,27 @@
+#ifndef AUDIO_FIXTURE_H
+#define AUDIO_FIXTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct AudioFixture {
+    int sample_rate = 0;
+    std::vector<int16_t> pcm;
+};
+
+// Sine at amplitude (full scale = 1.0)
+AudioFixture GenerateTone(int sample_rate, double frequency, double seconds, double amplitude);
+// Deterministic speech-like test signal: a gliding harmonic series under a syllable
+// envelope with pauses and a little noise, for the benchmark when no WAV is given
+AudioFixture GenerateSpeechLike(int sample_rate, double seconds);
+// 16-bit PCM WAV, stereo is mixed down to mono. Returns false if the file cannot be used.
+bool ReadWav(const std::string& path, AudioFixture& fixture);
+
+// Level of the frequency component in dBFS, least squares fit of a sine and cosine
+double ToneLevelDb(const int16_t* pcm, size_t samples, int sample_rate, double frequency);
+// Power of everything except the fitted tone relative to the tone, in dB
+double ThdNDb(const int16_t* pcm, size_t samples, int sample_rate, double frequency);
+
+#endif // AUDIO_FIXTURE_H
@@ -0,0 +1,40 @@
+#ifndef HOST_TEST_H
+#define HOST_TEST_H
+
+// Minimal test registry for the host build. TEST(suite, name) defines a test, CHECK
+// records a failure and carries on. host_tests [suite] runs one suite or all of them.
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+struct HostTest {
+    const char* suite;
+    const char* name;
+    void (*function)();
+    HostTest* next;
+};
+
+void RegisterHostTest(HostTest* test);
+void HostTestFailed(const char* file, int line, const char* expression);
+
+struct HostTestRegistrar {
+    explicit HostTestRegistrar(HostTest* test) { RegisterHostTest(test); }
+};
+
+#define TEST(suite, name) \
+    static void suite##_##name(); \
+    static HostTest suite##_##name##_test = {#suite, #name, suite##_##name, nullptr}; \
+    static HostTestRegistrar suite##_##name##_registrar(&suite##_##name##_test); \
+    static void suite##_##name()
+
+#define CHECK(expression) \
+    do { \
+        if (!(expression)) { \
+            HostTestFailed(__FILE__, __LINE__, #expression); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+#define CHECK_NEAR(a, b, tolerance) CHECK(std::fabs((double)(a) - (double)(b)) <= (tolerance))
+
+#endif // HOST_TEST_H
@@ -0,0 +1,45 @@
+#include "host_test.h"
+
+#include <cstring>
+
+static HostTest* tests = nullptr;
+static int failures = 0;
+
+void RegisterHostTest(HostTest* test) {
+    // Keep the definition order of each file
+    HostTest** tail = &tests;
+    while (*tail != nullptr) {
+        tail = &(*tail)->next;
+    }
+    *tail = test;
+}
+
+void HostTestFailed(const char* file, int line, const char* expression) {
+    fprintf(stderr, "%s:%d: CHECK failed: %s\n", file, line, expression);
+    failures++;
+}
+
+int main(int argc, char** argv) {
+    const char* suite = argc > 1 ? argv[1] : nullptr;
+    int run = 0;
+    int failed_tests = 0;
+    for (auto test = tests; test != nullptr; test = test->next) {
+        if (suite != nullptr && strcmp(suite, test->suite) != 0) {
+            continue;
+        }
+        int before = failures;
+        test->function();
+        run++;
+        bool passed = failures == before;
+        if (!passed) {
+            failed_tests++;
+        }
+        printf("[%s] %s.%s\n", passed ? "  OK  " : "FAILED", test->suite, test->name);
+    }
+    if (run == 0) {
+        fprintf(stderr, "No tests matched %s\n", suite);
+        return 1;
+    }
+    printf("%d tests, %d failed\n", run, failed_tests);
+    return failed_tests == 0 ? 0 : 1;
+}
@@ -0,0 +1,19 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+// Host build: warnings and errors go to stderr, info and debug are dropped unless
+// HOST_TEST_VERBOSE is set in the environment
+#include <cstdio>
+#include <cstdlib>
+
+inline bool host_log_verbose() {
+    static bool verbose = getenv("HOST_TEST_VERBOSE") != nullptr;
+    return verbose;
+}
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W (%s) " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) do { if (host_log_verbose()) fprintf(stderr, "I (%s) " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, format, ...) do { if (host_log_verbose()) fprintf(stderr, "D (%s) " format "\n", tag, ##__VA_ARGS__); } while (0)
+
+#endif // ESP_LOG_H
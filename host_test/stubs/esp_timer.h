@@ -0,0 +1,12 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+#include <chrono>
+#include <cstdint>
+
+inline int64_t esp_timer_get_time() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif // ESP_TIMER_H
@@ -0,0 +1,6 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+// Host build: no target specific options, the code takes its portable paths
+
+#endif // SDKCONFIG_H
@@ -0,0 +1,27 @@
+#include "host_test.h"
+#include "audio_kernels.h"
+
+#include <vector>
+
+TEST(audio_kernels, interleave_round_trip_at_any_alignment) {
+    for (size_t offset = 0; offset < 4; offset++) {
+        for (size_t frames : {1u, 7u, 8u, 33u, 480u}) {
+            std::vector<int16_t> in(frames * 2 + 8), left(frames + 8), right(frames + 8), out(frames * 2 + 8);
+            for (size_t i = 0; i < frames * 2; i++) {
+                in[offset + i] = (int16_t)(i * 7 - 1000);
+            }
+            audio_kernels::DeinterleaveStereo(in.data() + offset, left.data() + offset, right.data(), frames);
+            bool split = true;
+            for (size_t i = 0; i < frames; i++) {
+                split &= left[offset + i] == in[offset + i * 2] && right[i] == in[offset + i * 2 + 1];
+            }
+            CHECK(split);
+            audio_kernels::InterleaveStereo(left.data() + offset, right.data(), out.data() + offset, frames);
+            bool joined = true;
+            for (size_t i = 0; i < frames * 2; i++) {
+                joined &= out[offset + i] == in[offset + i];
+            }
+            CHECK(joined);
+        }
+    }
+}
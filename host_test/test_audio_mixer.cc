@@ -0,0 +1,96 @@
+#include "host_test.h"
+#include "alloc_counter.h"
+#include "audio_mixer.h"
+#include "playback_ring.h"
+
+#include <cstdlib>
+#include <vector>
+
+TEST(audio_mixer, ducks_speech_under_a_clip) {
+    PlaybackRing speech, clip;
+    speech.Initialize(48000);
+    clip.Initialize(48000);
+    AudioMixer mixer;
+    mixer.Initialize(16000);
+    mixer.AddVoice(&speech, 1.0f, true);
+    mixer.AddVoice(&clip, 1.0f, false);
+
+    std::vector<int16_t> constant(16000, 8000);
+    speech.Write(constant.data(), constant.size());
+    std::vector<int16_t> out(4000);
+    CHECK_EQ(mixer.Mix(out.data(), out.size()), out.size());
+    CHECK_NEAR(out.back(), 8000, 1);
+
+    std::vector<int16_t> silence(8000, 0);
+    clip.Write(silence.data(), silence.size());
+    CHECK_EQ(mixer.Mix(out.data(), out.size()), out.size());
+    // Ramped down to the duck gain
+    CHECK_NEAR(out.back(), 8000 * AUDIO_MIXER_DUCK_GAIN, 2);
+}
+
+TEST(audio_mixer, limiter_keeps_the_sum_in_range) {
+    PlaybackRing a, b;
+    a.Initialize(4096);
+    b.Initialize(4096);
+    AudioMixer mixer;
+    mixer.Initialize(16000);
+    mixer.AddVoice(&a, 1.0f, false);
+    mixer.AddVoice(&b, 1.0f, false);
+    std::vector<int16_t> loud(2048, 30000);
+    a.Write(loud.data(), loud.size());
+    b.Write(loud.data(), loud.size());
+    std::vector<int16_t> out(2048);
+    CHECK_EQ(mixer.Mix(out.data(), out.size()), out.size());
+    bool limited = true;
+    for (auto sample : out) {
+        limited &= sample > AUDIO_MIXER_LIMITER_THRESHOLD && sample <= 32767;
+    }
+    CHECK(limited);
+}
+
+TEST(audio_mixer, mix_does_not_allocate) {
+    PlaybackRing ring;
+    ring.Initialize(4096);
+    AudioMixer mixer;
+    mixer.Initialize(16000);
+    mixer.AddVoice(&ring, 1.0f, false);
+    std::vector<int16_t> pcm(1024, 1000), out(1024);
+    auto before = host_allocations();
+    for (int i = 0; i < 100; i++) {
+        ring.Write(pcm.data(), pcm.size());
+        mixer.Mix(out.data(), out.size());
+    }
+    CHECK_EQ(host_allocations(), before);
+}
+
+TEST(audio_mixer, short_voice_is_not_padded_with_silence) {
+    PlaybackRing speech, clip;
+    speech.Initialize(4096);
+    clip.Initialize(4096);
+    AudioMixer mixer;
+    mixer.Initialize(16000);
+    mixer.AddVoice(&speech, 1.0f, false);
+    mixer.AddVoice(&clip, 1.0f, false);
+
+    std::vector<int16_t> ones(2048, 1000);
+    clip.Write(ones.data(), 2048);
+    // The decoder is behind, only part of a block of speech is ready
+    speech.Write(ones.data(), 300);
+    std::vector<int16_t> out(1024);
+    CHECK_EQ(mixer.Mix(out.data(), out.size()), 300u);
+    CHECK_EQ(out[299], 2000);
+    CHECK_EQ(clip.size(), 2048u - 300);
+
+    // The rest of the speech arrives and continues where it stopped
+    speech.Write(ones.data(), 1024);
+    CHECK_EQ(mixer.Mix(out.data(), out.size()), out.size());
+    bool continuous = true;
+    for (auto sample : out) {
+        continuous &= sample == 2000;
+    }
+    CHECK(continuous);
+
+    // Once the speech has run dry the clip plays on alone
+    CHECK_EQ(mixer.Mix(out.data(), out.size()), 2048u - 300 - 1024);
+    CHECK_EQ(out[0], 1000);
+}
@@ -0,0 +1,75 @@
+#include "host_test.h"
+#include "audio_fixture.h"
+#include "endpointer.h"
+
+#include <vector>
+
+// 30 ms frames like the AFE hands them out, the VAD stays on speech for vad_tail_ms
+// after the signal stops, the way the AFE VAD hangs over
+static int FindEndpointMs(Endpointer& endpointer, const AudioFixture& fixture, int speech_end_ms, int vad_tail_ms) {
+    const size_t frame = fixture.sample_rate * 30 / 1000;
+    for (size_t offset = 0; offset + frame <= fixture.pcm.size(); offset += frame) {
+        int now_ms = (int)((offset + frame) * 1000 / fixture.sample_rate);
+        bool vad_speech = now_ms <= speech_end_ms + vad_tail_ms;
+        if (endpointer.Process(vad_speech, fixture.pcm.data() + offset, frame)) {
+            return now_ms;
+        }
+    }
+    return -1;
+}
+
+// Speech-like signal followed by silence with a little noise
+static AudioFixture SpeechThenSilence(double speech_seconds, double seconds) {
+    auto fixture = GenerateSpeechLike(16000, seconds);
+    for (size_t i = (size_t)(16000 * speech_seconds); i < fixture.pcm.size(); i++) {
+        fixture.pcm[i] = (i * 7919) % 61 - 30;
+    }
+    return fixture;
+}
+
+TEST(endpointer, ends_the_hangover_after_the_last_speech) {
+    EndpointerConfig config;
+    config.hangover_ms = 700;
+    Endpointer endpointer(config);
+    endpointer.Start();
+
+    // 1.75 s of syllables with short pauses inside, the signal ends at a pause
+    auto fixture = SpeechThenSilence(1.75, 4.0);
+    int endpoint_ms = FindEndpointMs(endpointer, fixture, 1750, 300);
+    // The pauses between syllables are shorter than the hangover and the energy
+    // threshold does not wait for the VAD tail
+    CHECK(endpoint_ms >= 1750 + 700 - 100);
+    CHECK(endpoint_ms <= 1750 + 700 + 30);
+    CHECK(!endpointer.active());
+    CHECK(endpointer.speech_ms() >= 1000);
+}
+
+TEST(endpointer, leading_noise_and_short_blips_do_not_end_the_turn) {
+    EndpointerConfig config;
+    config.min_speech_ms = 200;
+    config.hangover_ms = 500;
+    Endpointer endpointer(config);
+    endpointer.Start();
+
+    // 90 ms blip, then silence that the VAD still calls speech
+    auto fixture = SpeechThenSilence(0.09, 3.0);
+    CHECK_EQ(FindEndpointMs(endpointer, fixture, 3000, 0), -1);
+    CHECK(endpointer.active());
+
+    // Restarting forgets the earlier state, a real utterance still ends
+    endpointer.Start();
+    fixture = SpeechThenSilence(0.75, 3.0);
+    int endpoint_ms = FindEndpointMs(endpointer, fixture, 750, 0);
+    CHECK(endpoint_ms >= 750 + 500 - 100);
+    CHECK(endpoint_ms <= 750 + 500 + 30);
+}
+
+TEST(endpointer, reports_the_endpoint_once) {
+    Endpointer endpointer;
+    auto fixture = SpeechThenSilence(1.0, 3.0);
+    // Not armed
+    CHECK_EQ(FindEndpointMs(endpointer, fixture, 1000, 0), -1);
+    endpointer.Start();
+    CHECK(FindEndpointMs(endpointer, fixture, 1000, 0) > 0);
+    CHECK_EQ(FindEndpointMs(endpointer, fixture, 1000, 0), -1);
+}
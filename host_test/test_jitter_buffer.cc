@@ -0,0 +1,151 @@
+#include "host_test.h"
+#include "jitter_buffer.h"
+
+#include <vector>
+
+static void Put(JitterBuffer& buffer, uint32_t sequence, uint32_t arrival_ms) {
+    uint8_t data[4] = {(uint8_t)sequence};
+    buffer.Put(data, sizeof(data), sequence, arrival_ms);
+}
+
+TEST(jitter_buffer, plays_in_order_after_target_delay) {
+    JitterBuffer buffer(20, 60, 600, 64);
+    std::vector<uint8_t> packet;
+    Put(buffer, 1, 0);
+    CHECK_EQ(buffer.Get(packet, 0), kJitterBufferBuffering);
+    Put(buffer, 3, 40);
+    Put(buffer, 2, 41);
+    CHECK_EQ(buffer.Get(packet, 41), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 1);
+    CHECK_EQ(buffer.Get(packet, 41), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 2);
+    CHECK_EQ(buffer.Get(packet, 41), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 3);
+    CHECK_EQ(buffer.reordered_packets(), 1u);
+    CHECK_EQ(buffer.lost_packets(), 0u);
+}
+
+TEST(jitter_buffer, drops_duplicates_and_late_packets) {
+    JitterBuffer buffer(20, 20, 600, 64);
+    std::vector<uint8_t> packet;
+    Put(buffer, 1, 0);
+    Put(buffer, 1, 1);
+    CHECK_EQ(buffer.Get(packet, 1), kJitterBufferPacket);
+    CHECK_EQ(buffer.Get(packet, 1), kJitterBufferBuffering);
+    Put(buffer, 1, 30);
+    CHECK_EQ(buffer.late_packets(), 1u);
+}
+
+TEST(jitter_buffer, gives_up_on_packets_outside_the_window) {
+    JitterBuffer buffer(20, 20, 600, 64);
+    std::vector<uint8_t> packet;
+    Put(buffer, 1, 0);
+    CHECK_EQ(buffer.Get(packet, 0), kJitterBufferPacket);
+    Put(buffer, 100, 20);
+    CHECK(buffer.lost_packets() > 0);
+    // The rest of the window is held once, then reported lost and playback goes on at 100
+    CHECK_EQ(buffer.Get(packet, 20), kJitterBufferBuffering);
+    int lost = 0;
+    while (buffer.Get(packet, 40) == kJitterBufferLost) {
+        lost++;
+    }
+    CHECK(lost < 32);
+    CHECK_EQ(packet[0], 100);
+}
+
+TEST(jitter_buffer, waits_for_a_reordered_packet_while_draining) {
+    JitterBuffer buffer(20, 60, 600, 64);
+    std::vector<uint8_t> packet;
+    Put(buffer, 1, 0);
+    Put(buffer, 2, 20);
+    Put(buffer, 4, 40);
+    CHECK_EQ(buffer.Get(packet, 60), kJitterBufferPacket);
+    CHECK_EQ(buffer.Get(packet, 60), kJitterBufferPacket);
+    // 3 is missing with 4 already here, the decoder drains the buffer
+    CHECK_EQ(buffer.Get(packet, 60), kJitterBufferBuffering);
+    Put(buffer, 3, 65);
+    CHECK_EQ(buffer.Get(packet, 65), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 3);
+    CHECK_EQ(buffer.Get(packet, 65), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 4);
+    CHECK_EQ(buffer.lost_packets(), 0u);
+    CHECK_EQ(buffer.late_packets(), 0u);
+}
+
+TEST(jitter_buffer, gives_up_on_a_gap_after_the_hold_or_when_starving) {
+    JitterBuffer buffer(20, 60, 600, 64);
+    std::vector<uint8_t> packet;
+    Put(buffer, 1, 0);
+    Put(buffer, 2, 20);
+    Put(buffer, 5, 40);
+    CHECK_EQ(buffer.Get(packet, 60), kJitterBufferPacket);
+    CHECK_EQ(buffer.Get(packet, 60), kJitterBufferPacket);
+    CHECK_EQ(buffer.Get(packet, 60), kJitterBufferBuffering);
+    CHECK_EQ(buffer.Get(packet, 119), kJitterBufferBuffering);
+    // 3 and 4 are given up together once the hold is over
+    CHECK_EQ(buffer.Get(packet, 120), kJitterBufferLost);
+    CHECK_EQ(buffer.Get(packet, 120), kJitterBufferLost);
+    CHECK_EQ(buffer.Get(packet, 120), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 5);
+
+    Put(buffer, 7, 140);
+    CHECK_EQ(buffer.Get(packet, 140, true), kJitterBufferLost);
+    CHECK_EQ(buffer.Get(packet, 140), kJitterBufferPacket);
+    CHECK_EQ(buffer.lost_packets(), 3u);
+}
+
+TEST(jitter_buffer, flush_plays_a_reply_shorter_than_the_target_delay) {
+    JitterBuffer buffer(60, 120, 600, 64);
+    std::vector<uint8_t> packet;
+    // One 60 ms frame, below the 120 ms minimum delay
+    Put(buffer, 1, 0);
+    CHECK_EQ(buffer.Get(packet, 0, true), kJitterBufferBuffering);
+    buffer.Flush();
+    CHECK_EQ(buffer.Get(packet, 0), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 1);
+    CHECK_EQ(buffer.Get(packet, 0), kJitterBufferBuffering);
+    CHECK(buffer.empty());
+}
+
+TEST(jitter_buffer, flush_drains_the_tail_without_holding_gaps) {
+    JitterBuffer buffer(20, 60, 600, 64);
+    std::vector<uint8_t> packet;
+    for (uint32_t s = 1; s <= 4; s++) {
+        Put(buffer, s, s * 20);
+    }
+    for (int i = 0; i < 4; i++) {
+        CHECK_EQ(buffer.Get(packet, 80), kJitterBufferPacket);
+    }
+    CHECK_EQ(buffer.Get(packet, 80), kJitterBufferBuffering);
+    // The last frames of the reply, 6 is missing and less than the target is left
+    Put(buffer, 5, 100);
+    Put(buffer, 7, 140);
+    CHECK_EQ(buffer.Get(packet, 140), kJitterBufferBuffering);
+    buffer.Flush();
+    CHECK_EQ(buffer.Get(packet, 140), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 5);
+    CHECK_EQ(buffer.Get(packet, 140), kJitterBufferLost);
+    CHECK_EQ(buffer.Get(packet, 140), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 7);
+
+    // Reset starts a new stream that buffers again
+    buffer.Reset();
+    Put(buffer, 1, 200);
+    CHECK_EQ(buffer.Get(packet, 200), kJitterBufferBuffering);
+}
+
+TEST(jitter_buffer, starving_drains_a_stream_that_already_played) {
+    JitterBuffer buffer(20, 60, 600, 64);
+    std::vector<uint8_t> packet;
+    for (uint32_t s = 1; s <= 3; s++) {
+        Put(buffer, s, s * 20);
+    }
+    for (int i = 0; i < 3; i++) {
+        CHECK_EQ(buffer.Get(packet, 60), kJitterBufferPacket);
+    }
+    CHECK_EQ(buffer.Get(packet, 60), kJitterBufferBuffering);
+    Put(buffer, 4, 120);
+    CHECK_EQ(buffer.Get(packet, 120), kJitterBufferBuffering);
+    CHECK_EQ(buffer.Get(packet, 120, true), kJitterBufferPacket);
+    CHECK_EQ(packet[0], 4);
+}
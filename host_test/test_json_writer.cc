@@ -0,0 +1,43 @@
+#include "host_test.h"
+#include "alloc_counter.h"
+#include "json_writer.h"
+
+#include <string>
+
+TEST(json_writer, nested_containers_and_commas) {
+    std::string out;
+    JsonWriter json(out);
+    json.BeginObject().Field("type", "hello").Field("version", 3)
+        .Key("list").BeginArray().Int(1).BeginObject().Field("x", true).EndObject().String("s").EndArray()
+        .Key("empty").BeginObject().EndObject()
+        .Key("raw").Raw("{\"a\":1}")
+        .EndObject();
+    CHECK(out == "{\"type\":\"hello\",\"version\":3,\"list\":[1,{\"x\":true},\"s\"],\"empty\":{},\"raw\":{\"a\":1}}");
+}
+
+TEST(json_writer, escapes_strings) {
+    std::string out;
+    JsonWriter json(out);
+    json.BeginObject().Field("text", "a\"b\\c\n\t\x01 你好").EndObject();
+    CHECK(out == "{\"text\":\"a\\\"b\\\\c\\n\\t\\u0001 你好\"}");
+}
+
+TEST(json_writer, integers) {
+    std::string out;
+    JsonWriter json(out);
+    json.BeginArray().Int(-7).Int(0).Int(4294967295u).Int(INT64_MIN).EndArray();
+    CHECK(out == "[-7,0,4294967295,-9223372036854775808]");
+}
+
+TEST(json_writer, reused_buffer_does_not_allocate) {
+    std::string out;
+    std::string session_id = "0123456789abcdef0123456789abcdef";
+    { JsonWriter json(out, 128); }
+    auto before = host_allocations();
+    for (int i = 0; i < 100; i++) {
+        JsonWriter json(out, 128);
+        json.BeginObject().Field("session_id", session_id).Field("type", "listen")
+            .Field("state", "start").Field("mode", "auto").EndObject();
+    }
+    CHECK_EQ(host_allocations(), before);
+}
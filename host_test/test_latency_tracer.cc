@@ -0,0 +1,26 @@
+#include "host_test.h"
+#include "latency_tracer.h"
+
+#include <string>
+
+TEST(latency_tracer, json_lists_every_stage_of_the_recent_sessions) {
+    auto& tracer = LatencyTracer::GetInstance();
+    tracer.StartSession();
+    tracer.Mark(kLatencyTraceAudioChannelOpened);
+    tracer.Mark(kLatencyTraceFirstAudioSent);
+    CHECK(tracer.EndSession());
+    CHECK(!tracer.EndSession());
+
+    auto json = tracer.GetJson();
+    CHECK_EQ(json.rfind("{\"sessions\":1,\"stages\":{\"wake_word_detected\":{\"count\":0,\"p50\":-1,", 0), 0u);
+    CHECK(json.find("\"audio_channel_opened\":{\"count\":1,\"p50\":0,\"p90\":0,\"p99\":0}") != std::string::npos);
+    CHECK(json.find("\"first_audio_played\":{\"count\":0,\"p50\":-1,\"p90\":-1,\"p99\":-1}}}") != std::string::npos);
+
+    // Written in place into a larger message
+    std::string message;
+    JsonWriter writer(message);
+    writer.BeginObject().Key("latency");
+    tracer.WriteJson(writer);
+    writer.Field("type", "status").EndObject();
+    CHECK_EQ(message, "{\"latency\":" + json + ",\"type\":\"status\"}");
+}
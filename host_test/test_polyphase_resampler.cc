@@ -0,0 +1,135 @@
+#include "host_test.h"
+#include "audio_fixture.h"
+#include "alloc_counter.h"
+#include "polyphase_resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Resamples the whole fixture in frames of frame_samples
+static std::vector<int16_t> Resample(PolyphaseResampler& resampler, const std::vector<int16_t>& in, size_t frame_samples) {
+    std::vector<int16_t> out;
+    std::vector<int16_t> frame(resampler.GetOutputSamples(frame_samples));
+    for (size_t offset = 0; offset < in.size(); offset += frame_samples) {
+        size_t samples = std::min(frame_samples, in.size() - offset);
+        size_t produced = resampler.Process(in.data() + offset, samples, frame.data());
+        CHECK(produced <= resampler.GetOutputSamples(samples));
+        out.insert(out.end(), frame.begin(), frame.begin() + produced);
+    }
+    return out;
+}
+
+TEST(resampler, output_length_follows_ratio) {
+    const int rates[][2] = {{48000, 16000}, {44100, 16000}, {16000, 24000}, {24000, 16000}, {16000, 48000}};
+    for (auto& rate : rates) {
+        PolyphaseResampler resampler;
+        CHECK(resampler.Configure(rate[0], rate[1]));
+        std::vector<int16_t> in(rate[0]);
+        auto out = Resample(resampler, in, rate[0] / 50);
+        CHECK_NEAR(out.size(), rate[1], 2);
+    }
+}
+
+TEST(resampler, frame_size_does_not_change_output) {
+    auto fixture = GenerateSpeechLike(48000, 0.5);
+    PolyphaseResampler a, b;
+    a.Configure(48000, 16000);
+    b.Configure(48000, 16000);
+    auto whole = Resample(a, fixture.pcm, 960);
+    auto odd = Resample(b, fixture.pcm, 137);
+    CHECK_EQ(whole.size(), odd.size());
+    CHECK(whole == odd);
+}
+
+TEST(resampler, process_in_place) {
+    auto fixture = GenerateSpeechLike(16000, 0.2);
+    PolyphaseResampler a, b;
+    a.Configure(16000, 24000);
+    b.Configure(16000, 24000);
+    auto expected = Resample(a, fixture.pcm, 320);
+    std::vector<int16_t> in_place;
+    std::vector<int16_t> frame(b.GetOutputSamples(320));
+    for (size_t offset = 0; offset < fixture.pcm.size(); offset += 320) {
+        std::copy(fixture.pcm.begin() + offset, fixture.pcm.begin() + offset + 320, frame.begin());
+        size_t produced = b.Process(frame.data(), 320, frame.data());
+        in_place.insert(in_place.end(), frame.begin(), frame.begin() + produced);
+    }
+    CHECK(in_place == expected);
+}
+
+TEST(resampler, clean_1khz_tone) {
+    const int rates[][2] = {{48000, 16000}, {44100, 16000}, {16000, 24000}, {24000, 16000}};
+    for (auto& rate : rates) {
+        PolyphaseResampler resampler;
+        resampler.Configure(rate[0], rate[1]);
+        auto tone = GenerateTone(rate[0], 1000, 1.0, 0.5);
+        auto out = Resample(resampler, tone.pcm, rate[0] / 50);
+        // Skip the filter delay
+        size_t skip = rate[1] / 10;
+        CHECK(ThdNDb(out.data() + skip, out.size() - skip, rate[1], 1000) < -70);
+        CHECK_NEAR(ToneLevelDb(out.data() + skip, out.size() - skip, rate[1], 1000), 20 * std::log10(0.5), 0.5);
+    }
+}
+
+TEST(resampler, process_does_not_allocate) {
+    PolyphaseResampler resampler;
+    resampler.Configure(48000, 16000);
+    std::vector<int16_t> in(960), out(resampler.GetOutputSamples(960));
+    resampler.Process(in.data(), in.size(), out.data());
+    auto before = host_allocations();
+    for (int i = 0; i < 100; i++) {
+        resampler.Process(in.data(), in.size(), out.data());
+    }
+    CHECK_EQ(host_allocations(), before);
+}
+
+// Level of the tone at measure_frequency in the output, relative to the input tone
+static double ResampledLevelDb(int input_rate, int output_rate, double frequency, double measure_frequency) {
+    PolyphaseResampler resampler;
+    resampler.Configure(input_rate, output_rate);
+    auto tone = GenerateTone(input_rate, frequency, 0.25, 0.5);
+    std::vector<int16_t> out(resampler.GetOutputSamples(tone.pcm.size()));
+    out.resize(resampler.Process(tone.pcm.data(), tone.pcm.size(), out.data()));
+    size_t skip = output_rate / 20;
+    return ToneLevelDb(out.data() + skip, out.size() - skip, output_rate, measure_frequency) - 20 * std::log10(0.5);
+}
+
+TEST(resampler, flat_pass_band) {
+    const int rates[][2] = {{48000, 16000}, {44100, 16000}, {24000, 16000}, {16000, 24000}, {16000, 48000}};
+    for (auto& rate : rates) {
+        double nyquist = std::min(rate[0], rate[1]) / 2.0;
+        for (double frequency = 200; frequency <= 0.8 * nyquist; frequency += 400) {
+            CHECK_NEAR(ResampledLevelDb(rate[0], rate[1], frequency, frequency), 0.0, 0.1);
+        }
+    }
+}
+
+TEST(resampler, decimation_does_not_alias) {
+    const int rates[][2] = {{48000, 16000}, {44100, 16000}, {24000, 16000}};
+    for (auto& rate : rates) {
+        for (double frequency = rate[1] / 2.0 + 250; frequency < rate[0] / 2.0; frequency += 750) {
+            double alias = std::fabs(frequency - rate[1] * std::round(frequency / rate[1]));
+            if (alias < 100 || alias > rate[1] / 2.0 - 100) {
+                continue;
+            }
+            CHECK(ResampledLevelDb(rate[0], rate[1], frequency, alias) < -65);
+        }
+    }
+    // The case that used to fold back at -17 dB
+    CHECK(ResampledLevelDb(48000, 16000, 9000, 7000) < -65);
+}
+
+TEST(resampler, interpolation_suppresses_images) {
+    const int rates[][2] = {{16000, 24000}, {16000, 48000}, {24000, 48000}};
+    for (auto& rate : rates) {
+        for (double frequency = 250; frequency < rate[0] / 2.0; frequency += 750) {
+            double image = rate[0] - frequency;
+            // A tone at the output Nyquist frequency can't be measured
+            if (std::fabs(image - rate[1] / 2.0) < 100) {
+                continue;
+            }
+            CHECK(ResampledLevelDb(rate[0], rate[1], frequency, image) < -65);
+        }
+    }
+}
@@ -0,0 +1,168 @@
+#include "host_test.h"
+#include "alloc_counter.h"
+#include "packet_ring.h"
+#include "chunk_ring.h"
+#include "playback_ring.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+TEST(packet_ring, keeps_order_and_metadata) {
+    PacketRing ring(4, 64);
+    uint8_t data[64];
+    for (int i = 0; i < 4; i++) {
+        data[0] = i;
+        CHECK(ring.Push(data, 10 + i, 100 + i, 1000 + i));
+    }
+    CHECK(!ring.Push(data, 1));
+    CHECK_EQ(ring.dropped_packets(), 1u);
+    CHECK(!ring.Push(data, 65));
+    for (int i = 0; i < 4; i++) {
+        size_t size;
+        uint32_t sequence, timestamp;
+        auto packet = ring.Front(size, &sequence, &timestamp);
+        CHECK(packet != nullptr);
+        CHECK_EQ(packet[0], i);
+        CHECK_EQ(size, 10u + i);
+        CHECK_EQ(sequence, 100u + i);
+        CHECK_EQ(timestamp, 1000u + i);
+        ring.Pop();
+    }
+    size_t size;
+    CHECK(ring.Front(size) == nullptr);
+}
+
+TEST(packet_ring, push_and_pop_do_not_allocate) {
+    PacketRing ring(8, 256);
+    uint8_t data[256] = {};
+    auto before = host_allocations();
+    for (int i = 0; i < 1000; i++) {
+        ring.Push(data, sizeof(data));
+        size_t size;
+        ring.Front(size);
+        ring.Pop();
+    }
+    CHECK_EQ(host_allocations(), before);
+}
+
+TEST(packet_ring, packs_variable_sized_packets_across_the_wrap) {
+    // Room for about ten small packets, although one may be 512 bytes
+    PacketRing ring(96, 512, 256);
+    uint8_t data[512];
+    size_t pushed = 0, popped = 0;
+    for (int round = 0; round < 200; round++) {
+        size_t size = 1 + (round * 7) % 20;
+        while (ring.Push(data, size, pushed)) {
+            pushed++;
+        }
+        // Full by bytes long before it is full by count
+        CHECK(ring.size() >= 5 && ring.size() < 96);
+        for (int i = 0; i < 3; i++) {
+            uint32_t sequence;
+            CHECK(ring.Front(size, &sequence) != nullptr);
+            CHECK_EQ(sequence, popped);
+            ring.Pop();
+            popped++;
+        }
+    }
+    // Too large for the buffer, not just for the free space
+    CHECK(!ring.Push(data, 300));
+    ring.Clear();
+    CHECK(ring.empty());
+    CHECK(ring.Push(data, 200));
+    size_t size;
+    CHECK(ring.Front(size) != nullptr);
+    CHECK_EQ(size, 200u);
+}
+
+TEST(chunk_ring, hands_out_whole_chunks) {
+    ChunkRing ring;
+    CHECK(ring.Initialize(4, 3));
+    int16_t samples[10];
+    for (int i = 0; i < 10; i++) {
+        samples[i] = i;
+    }
+    ring.Write(samples, 6);
+    auto chunk = ring.Front();
+    CHECK(chunk != nullptr);
+    CHECK_EQ(chunk[0], 0);
+    CHECK_EQ(chunk[3], 3);
+    ring.Pop();
+    CHECK(ring.Front() == nullptr);
+    ring.Write(samples + 6, 4);
+    chunk = ring.Front();
+    CHECK(chunk != nullptr);
+    CHECK_EQ(chunk[0], 4);
+    CHECK_EQ(chunk[3], 7);
+}
+
+TEST(playback_ring, clear_frees_the_whole_capacity_for_the_writer) {
+    PlaybackRing ring;
+    CHECK(ring.Initialize(1000));
+    std::vector<int16_t> samples(1000), out(1000);
+    for (int i = 0; i < 1000; i++) {
+        samples[i] = i;
+    }
+    ring.Write(samples.data(), 600);
+    ring.Clear();
+    // The reader has not run since the Clear, the writer must not wait for it
+    CHECK_EQ(ring.Write(samples.data(), 1000), 1000u);
+    CHECK_EQ(ring.size(), 1000u);
+    CHECK_EQ(ring.Read(out.data(), 1000), 1000u);
+    CHECK_EQ(out[0], 0);
+    CHECK_EQ(out[999], 999);
+}
+
+TEST(playback_ring, clear_keeps_later_writes) {
+    PlaybackRing ring;
+    CHECK(ring.Initialize(1000));
+    std::vector<int16_t> samples(300), out(300);
+    for (int i = 0; i < 300; i++) {
+        samples[i] = i;
+    }
+    ring.Write(samples.data(), 200);
+    ring.Clear();
+    CHECK_EQ(ring.size(), 0u);
+    ring.Write(samples.data(), 100);
+    CHECK_EQ(ring.size(), 100u);
+    CHECK_EQ(ring.Read(out.data(), 300), 100u);
+    CHECK_EQ(out[0], 0);
+    CHECK_EQ(out[99], 99);
+    CHECK_EQ(ring.size(), 0u);
+}
+
+TEST(playback_ring, producer_consumer_order) {
+    PlaybackRing ring;
+    ring.Initialize(257);
+    const int total = 50000;
+    std::thread producer([&ring]() {
+        int16_t block[64];
+        int next = 0;
+        while (next < total) {
+            int count = std::min(64, total - next);
+            for (int i = 0; i < count; i++) {
+                block[i] = (int16_t)(next + i);
+            }
+            auto written = ring.Write(block, count);
+            next += written;
+            if (written == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    int16_t block[100];
+    int expected = 0;
+    bool in_order = true;
+    while (expected < total) {
+        size_t count = ring.Read(block, 100);
+        if (count == 0) {
+            std::this_thread::yield();
+        }
+        for (size_t i = 0; i < count; i++) {
+            in_order &= block[i] == (int16_t)expected++;
+        }
+    }
+    producer.join();
+    CHECK(in_order);
+}
@@ -0,0 +1,52 @@
+#include "host_test.h"
+#include "task_stats.h"
+
+TEST(log_histogram, percentiles_are_bucket_upper_bounds) {
+    LogHistogram histogram;
+    for (int i = 0; i < 90; i++) {
+        histogram.Record(10);
+    }
+    for (int i = 0; i < 10; i++) {
+        histogram.Record(1000);
+    }
+    CHECK_EQ(histogram.count(), 100u);
+    CHECK_EQ(histogram.Percentile(50), 16u);
+    CHECK_EQ(histogram.Percentile(99), 1000u);
+    CHECK_EQ(histogram.max(), 1000u);
+    histogram.Reset();
+    CHECK_EQ(histogram.count(), 0u);
+}
+
+TEST(task_stats, same_label_shares_a_slot) {
+    TaskStats stats("test");
+    auto a = stats.Register("a");
+    auto b = stats.Register("b");
+    CHECK(a != b);
+    CHECK_EQ(stats.Register("a"), a);
+}
+
+TEST(task_stats, overflowing_labels_go_to_other) {
+    static const char* labels[] = {"l0", "l1", "l2", "l3", "l4", "l5", "l6", "l7", "l8", "l9",
+        "l10", "l11", "l12", "l13", "l14", "l15", "l16", "l17"};
+    TaskStats stats("test");
+    for (int i = 0; i < TASK_STATS_MAX_LABELS; i++) {
+        CHECK_EQ(stats.Register(labels[i]), i);
+    }
+    // Past the named slots every label shares "other", the last named one keeps its own
+    auto other = stats.Register(labels[TASK_STATS_MAX_LABELS]);
+    CHECK_EQ(other, TASK_STATS_MAX_LABELS);
+    CHECK_EQ(stats.Register(labels[TASK_STATS_MAX_LABELS + 1]), other);
+    CHECK_EQ(stats.Register(labels[TASK_STATS_MAX_LABELS - 1]), TASK_STATS_MAX_LABELS - 1);
+}
+
+TEST(task_stats, reset_starts_new_histograms_and_keeps_labels) {
+    TaskStats stats("test");
+    auto a = stats.Register("a");
+    stats.RecordRun(a, 5000);
+    stats.RecordWait(a, 100);
+    CHECK_EQ(stats.run(a).count(), 1u);
+    stats.Reset();
+    CHECK_EQ(stats.run(a).count(), 0u);
+    CHECK_EQ(stats.run(a).max(), 0u);
+    CHECK_EQ(stats.Register("a"), a);
+}
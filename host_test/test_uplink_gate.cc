@@ -0,0 +1,56 @@
+#include "host_test.h"
+#include "uplink_gate.h"
+
+#include <vector>
+
+TEST(uplink_gate, closes_after_hangover_and_sends_keepalives) {
+    UplinkGateConfig config;
+    config.hangover_ms = 600;
+    config.keepalive_ms = 400;
+    UplinkGate gate(config);
+    gate.Reset();
+
+    std::vector<int16_t> speech(960, 10000);
+    std::vector<int16_t> silence(960, 0);
+    // 60 ms frames, one packet each
+    gate.Analyze(speech.data(), speech.size());
+    CHECK(gate.Accept(100, 60));
+    int sent = 0;
+    for (int i = 0; i < 10; i++) {
+        gate.Analyze(silence.data(), silence.size());
+        sent += gate.Accept(10, 60);
+    }
+    // The hangover covers the first 600 ms
+    CHECK_EQ(sent, 10);
+    sent = 0;
+    for (int i = 0; i < 20; i++) {
+        gate.Analyze(silence.data(), silence.size());
+        sent += gate.Accept(10, 60);
+    }
+    // First packet of the pause, then one per 400 ms
+    CHECK(sent >= 3 && sent <= 4);
+    CHECK(gate.bytes_saved() > 0);
+
+    gate.Analyze(speech.data(), speech.size());
+    CHECK(gate.Accept(100, 60));
+}
+
+TEST(uplink_gate, keepalive_follows_the_packet_duration) {
+    UplinkGateConfig config;
+    config.hangover_ms = 0;
+    config.keepalive_ms = 400;
+    UplinkGate gate(config);
+    gate.Reset();
+
+    // 10 ms capture frames, 20 ms packets
+    std::vector<int16_t> silence(160, 0);
+    int sent = 0;
+    for (int i = 0; i < 200; i++) {
+        gate.Analyze(silence.data(), silence.size());
+        if (i % 2 == 1) {
+            sent += gate.Accept(10, 20);
+        }
+    }
+    // 2 s of silence, the first packet of the pause and one per 400 ms
+    CHECK(sent >= 5 && sent <= 6);
+}
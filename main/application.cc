@@ -8,9 +8,12 @@
 #include "websocket_protocol.h"
 #include "font_awesome_symbols.h"
 #include "iot/thing_manager.h"
+#include "audio_kernels.h"
+#include "latency_tracer.h"
 
 #include <cstring>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <cJSON.h>
 #include <driver/gpio.h>
 #include <arpa/inet.h>
@@ -38,14 +41,94 @@ static const char* const STATE_STRINGS[] = {
     "invalid_state"
 };
 
-Application::Application() : background_task_(4096 * 8) {
+#if CONFIG_ENDPOINTER_ENABLE
+static EndpointerConfig GetEndpointerConfig() {
+    EndpointerConfig config;
+    config.hangover_ms = CONFIG_ENDPOINTER_HANGOVER_MS;
+    config.min_speech_ms = CONFIG_ENDPOINTER_MIN_SPEECH_MS;
+    config.energy_threshold_dbfs = CONFIG_ENDPOINTER_ENERGY_THRESHOLD_DBFS;
+    return config;
+}
+#endif
+
+#if CONFIG_UPLINK_SILENCE_GATE
+static UplinkGateConfig GetUplinkGateConfig() {
+    UplinkGateConfig config;
+    config.threshold_dbfs = CONFIG_UPLINK_GATE_THRESHOLD_DBFS;
+    config.hangover_ms = CONFIG_UPLINK_GATE_HANGOVER_MS;
+    return config;
+}
+#endif
+
+Application::Application()
+    :
+#if CONFIG_ENDPOINTER_ENABLE
+      endpointer_(GetEndpointerConfig()),
+#endif
+      main_tasks_(MAIN_TASK_QUEUE_SIZE),
+      main_task_stats_("main_loop"),
+      audio_stats_("audio_pipeline"),
+      background_task_(4096 * 8, BACKGROUND_TASK_CORES, "audio_worker"),
+      audio_decode_queue_(AUDIO_DECODE_QUEUE_CAPACITY, AUDIO_DECODE_PACKET_MAX_SIZE, AUDIO_DECODE_QUEUE_BYTES),
+      jitter_buffer_(OPUS_FRAME_DURATION_MS, JITTER_BUFFER_MIN_DELAY_MS, JITTER_BUFFER_MAX_DELAY_MS,
+          AUDIO_DECODE_PACKET_MAX_SIZE),
+      audio_send_queue_(AUDIO_SEND_QUEUE_CAPACITY, OPUS_CODEC_MAX_PACKET_SIZE, AUDIO_SEND_QUEUE_BYTES)
+#if CONFIG_UPLINK_SILENCE_GATE
+      , uplink_gate_(GetUplinkGateConfig())
+#endif
+      {
+    audio_stats_.Register("input_resample");
+    audio_stats_.Register("feed");
+    audio_stats_.Register("decode");
+    audio_stats_.Register("output_resample");
+    send_packet_.reserve(OPUS_CODEC_MAX_PACKET_SIZE);
+
     event_group_ = xEventGroupCreate();
     action_event_group_ =  xEventGroupCreate();
+
+#if CONFIG_ENDPOINTER_ENABLE
+    esp_timer_create_args_t endpoint_timer_args = {
+        .callback = [](void* arg) {
+            auto app = static_cast<Application*>(arg);
+            app->Schedule([app]() {
+                app->OnEndpointTimeout();
+            }, "endpoint_timeout");
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "Endpoint Timer",
+        .skip_unhandled_events = false,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&endpoint_timer_args, &endpoint_timer_));
+#endif
+#if CONFIG_TASK_STATS_DUMP_INTERVAL_S > 0
+    esp_timer_create_args_t task_stats_timer_args = {
+        .callback = [](void* arg) {
+            auto app = static_cast<Application*>(arg);
+            app->Schedule([app]() {
+                app->DumpTaskStats();
+            }, "task_stats");
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "Task Stats Timer",
+        .skip_unhandled_events = true,
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&task_stats_timer_args, &task_stats_timer_));
+#endif
     ota_.SetCheckVersionUrl(CONFIG_OTA_VERSION_URL);
     ota_.SetHeader("Device-Id", SystemInfo::GetMacAddress().c_str());
 }
 
 Application::~Application() {
+#if CONFIG_ENDPOINTER_ENABLE
+    esp_timer_stop(endpoint_timer_);
+    esp_timer_delete(endpoint_timer_);
+#endif
+#if CONFIG_TASK_STATS_DUMP_INTERVAL_S > 0
+    esp_timer_stop(task_stats_timer_);
+    esp_timer_delete(task_stats_timer_);
+#endif
     vEventGroupDelete(event_group_);
 }
 
@@ -106,22 +189,22 @@ void Application::Alert(const std::string& title, const std::string& message) {
     }
 }
 
+// Plays an embedded .p3 clip on its own mixer voice, on top of any speech
 void Application::PlayLocalFile(const char* data, size_t size) {
     ESP_LOGI(TAG, "PlayLocalFile: %zu bytes", size);
-    SetDecodeSampleRate(16000);
-    for (const char* p = data; p < data + size; ) {
-        auto p3 = (BinaryProtocol3*)p;
-        p += sizeof(BinaryProtocol3);
-
-        auto payload_size = ntohs(p3->payload_size);
-        std::vector<uint8_t> opus;
-        opus.resize(payload_size);
-        memcpy(opus.data(), p3->payload, payload_size);
-        p += payload_size;
-
-        std::lock_guard<std::mutex> lock(mutex_);
-        audio_decode_queue_.emplace_back(std::move(opus));
-    }
+    clip_pending_ = true;
+    Schedule([this, data, size]() {
+        Board::GetInstance().GetAudioCodec()->EnableOutput(true);
+        last_output_time_ = std::chrono::steady_clock::now();
+        // A new clip replaces the one playing
+        background_task_.Schedule([this, data, size]() {
+            clip_data_ = data;
+            clip_end_ = data + size;
+            clip_decoder_->ResetState();
+            clip_ring_.Clear();
+            DecodeClip();
+        }, kBackgroundStreamDecode, kBackgroundPolicyBlock, "play_clip");
+    }, "play_clip");
 }
 
 void Application::ToggleChatState() {
@@ -132,9 +215,10 @@ void Application::ToggleChatState() {
         }
 
         if (device_state_ == kDeviceStateIdle) {
+            LatencyTracer::GetInstance().StartSession();
             SetDeviceState(kDeviceStateConnecting);
             SetActionState(kActionStateStand);
-            if (!protocol_->OpenAudioChannel()) {
+            if (!OpenAudioChannel()) {
                 Alert("Error", "Failed to open audio channel");
                 SetDeviceState(kDeviceStateIdle);
                 return;
@@ -148,7 +232,7 @@ void Application::ToggleChatState() {
         } else if (device_state_ == kDeviceStateListening) {
             protocol_->CloseAudioChannel();
         }
-    });
+    }, "toggle_chat");
 }
 
 void Application::StartListening() {
@@ -160,9 +244,10 @@ void Application::StartListening() {
         
         keep_listening_ = false;
         if (device_state_ == kDeviceStateIdle) {
+            LatencyTracer::GetInstance().StartSession();
             if (!protocol_->IsAudioChannelOpened()) {
                 SetDeviceState(kDeviceStateConnecting);
-                if (!protocol_->OpenAudioChannel()) {
+                if (!OpenAudioChannel()) {
                     SetDeviceState(kDeviceStateIdle);
                     Alert("Error", "Failed to open audio channel");
                     return;
@@ -177,7 +262,7 @@ void Application::StartListening() {
             vTaskDelay(pdMS_TO_TICKS(120));
             SetDeviceState(kDeviceStateListening);
         }
-    });
+    }, "start_listening");
 }
 
 void Application::StopListening() {
@@ -187,7 +272,7 @@ void Application::StopListening() {
             SetDeviceState(kDeviceStateIdle);
             SetActionState(kActionStateSleep);
         }
-    });
+    }, "stop_listening");
 }
 
 void Application::Start() {
@@ -199,12 +284,32 @@ void Application::Start() {
     /* Setup the audio codec */
     auto codec = board.GetAudioCodec();
     opus_decode_sample_rate_ = codec->output_sample_rate();
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
-    opus_encoder_ = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
+    opus_decoder_ = std::make_unique<OpusDownlinkDecoder>(opus_decode_sample_rate_, 1);
+    opus_encoder_ = std::make_unique<OpusUplinkEncoder>(16000, 1, OPUS_FRAME_DURATION_MS);
+    // With DTX the encoder codes silence as occasional comfort noise frames
+#if CONFIG_UPLINK_DTX
+    opus_encoder_->SetDtx(true);
+#else
+    opus_encoder_->SetDtx(false);
+#endif
     if (codec->input_sample_rate() != 16000) {
         input_resampler_.Configure(codec->input_sample_rate(), 16000);
         reference_resampler_.Configure(codec->input_sample_rate(), 16000);
     }
+    InitializeInputBuffers();
+    playback_ahead_samples_ = codec->output_sample_rate() / 1000 * CONFIG_AUDIO_PLAYBACK_AHEAD_MS;
+    // The decoder tops the rings up one frame at a time, leave room for one frame past the target
+    tts_ring_.Initialize(playback_ahead_samples_ + codec->output_sample_rate() / 1000 * OPUS_FRAME_DURATION_MS * 2);
+    clip_ring_.Initialize(playback_ahead_samples_ + codec->output_sample_rate() / 1000 * OPUS_FRAME_DURATION_MS * 2);
+    // Speech is turned down while a local clip plays
+    mixer_.Initialize(codec->output_sample_rate());
+    mixer_.AddVoice(&tts_ring_, 1.0f, true);
+    mixer_.AddVoice(&clip_ring_, 1.0f, false);
+    // Local clips are 16 kHz
+    clip_decoder_ = std::make_unique<OpusDecoderWrapper>(16000, 1);
+    if (codec->output_sample_rate() != 16000) {
+        clip_resampler_.Configure(16000, codec->output_sample_rate());
+    }
     codec->OnInputReady([this, codec]() {
         BaseType_t higher_priority_task_woken = pdFALSE;
         xEventGroupSetBitsFromISR(event_group_, AUDIO_INPUT_READY_EVENT, &higher_priority_task_woken);
@@ -217,6 +322,12 @@ void Application::Start() {
     });
     codec->Start();
 
+    xTaskCreate([](void* arg) {
+        Application* app = (Application*)arg;
+        app->PlaybackTask();
+        vTaskDelete(NULL);
+    }, "audio_playback", 4096, this, 3, &playback_task_);
+
     /* Start the main loop */
     xTaskCreate([](void* arg) {
         Application* app = (Application*)arg;
@@ -235,18 +346,18 @@ void Application::Start() {
     }, "check_new_version", 4096 * 2, this, 1, nullptr);
 
 #if CONFIG_IDF_TARGET_ESP32S3
-    audio_processor_.Initialize(codec->input_channels(), codec->input_reference());
+    // One AFE instance feeds both the uplink and the wake word detection
+    audio_front_end_.Initialize(codec->input_channels(), codec->input_reference());
+    audio_processor_.Initialize(audio_front_end_);
     audio_processor_.OnOutput([this](std::vector<int16_t>&& data) {
         background_task_.Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
-                });
+            opus_encoder_->Encode(std::move(data), [this](const std::vector<uint8_t>& opus) {
+                QueueAudioSend(opus);
             });
-        });
+        }, kBackgroundStreamEncode, kBackgroundPolicyDropOldest, "encode");
     });
 
-    wake_word_detect_.Initialize(codec->input_channels(), codec->input_reference());
+    wake_word_detect_.Initialize(audio_front_end_);
     wake_word_detect_.OnVadStateChange([this](bool speaking) {
         Schedule([this, speaking]() {
             if (device_state_ == kDeviceStateListening) {
@@ -258,8 +369,25 @@ void Application::Start() {
                 auto led = Board::GetInstance().GetLed();
                 led->OnStateChanged();
             }
-        });
+        }, "vad_change");
+    });
+
+#if CONFIG_ENDPOINTER_ENABLE
+    // End the auto stop turn on the device instead of waiting for the server
+    audio_front_end_.AddListener([this](const afe_fetch_result_t* result) {
+        if (endpointer_.Process(result->vad_state == AFE_VAD_SPEECH, result->data, result->data_size / sizeof(int16_t))) {
+            Schedule([this]() {
+                if (device_state_ == kDeviceStateListening && keep_listening_) {
+                    protocol_->SendStopListening();
+                    // Stay in listening until the server answers, just stop the uplink
+                    audio_processor_.Stop();
+                    endpoint_pending_ = true;
+                    esp_timer_start_once(endpoint_timer_, CONFIG_ENDPOINTER_RESPONSE_TIMEOUT_MS * 1000);
+                }
+            }, "endpoint");
+        }
     });
+#endif
 
     wake_word_detect_.OnWakeWordDetected([this](const std::string& wake_word) {
         auto& app = Application::GetInstance();
@@ -269,7 +397,7 @@ void Application::Start() {
                 SetDeviceState(kDeviceStateConnecting);
                 wake_word_detect_.EncodeWakeWordData();
 
-                if (!protocol_->OpenAudioChannel()) {
+                if (!OpenAudioChannel()) {
                     ESP_LOGE(TAG, "Failed to open audio channel");
                     SetDeviceState(kDeviceStateIdle);
                     wake_word_detect_.StartDetection();
@@ -291,7 +419,7 @@ void Application::Start() {
             }
             // Resume detection
             wake_word_detect_.StartDetection();
-        });
+        }, "wake_word");
     });
     wake_word_detect_.StartDetection();
 
@@ -317,13 +445,15 @@ void Application::Start() {
     protocol_->OnNetworkError([this](const std::string& message) {
         Alert("Error", std::move(message));
     });
-    protocol_->OnIncomingAudio([this](std::vector<uint8_t>&& data) {
-        std::lock_guard<std::mutex> lock(mutex_);
+    protocol_->OnIncomingAudio([this](const uint8_t* data, size_t size, uint32_t sequence) {
+        LatencyTracer::GetInstance().Mark(kLatencyTraceFirstAudioReceived);
         if (device_state_ == kDeviceStateSpeaking) {
-            audio_decode_queue_.emplace_back(std::move(data));
+            uint32_t now_ms = esp_timer_get_time() / 1000;
+            audio_decode_queue_.Push(data, size, sequence, now_ms);
         }
     });
     protocol_->OnAudioChannelOpened([this, codec, &board]() {
+        LatencyTracer::GetInstance().Mark(kLatencyTraceAudioChannelOpened);
         board.SetPowerSaveMode(false);
         if (protocol_->server_sample_rate() != codec->output_sample_rate()) {
             ESP_LOGW(TAG, "服务器的音频采样率 %d 与设备输出的采样率 %d 不一致，重采样后可能会失真",
@@ -341,7 +471,7 @@ void Application::Start() {
             auto display = Board::GetInstance().GetDisplay();
             display->SetChatMessage("", "");
             SetDeviceState(kDeviceStateIdle);
-        });
+        }, "channel_closed");
     });
     protocol_->OnIncomingJson([this, display](const cJSON* root) {
         // Parse JSON data
@@ -349,24 +479,26 @@ void Application::Start() {
         if (strcmp(type->valuestring, "tts") == 0) {
             auto state = cJSON_GetObjectItem(root, "state");
             if (strcmp(state->valuestring, "start") == 0) {
+                LatencyTracer::GetInstance().Mark(kLatencyTraceTtsStart);
                 Schedule([this]() {
                     aborted_ = false;
+                    // A new reply right after "tts stop" continues the one being played out
+                    tts_stopping_ = false;
                     if (device_state_ == kDeviceStateIdle || device_state_ == kDeviceStateListening) {
                         SetDeviceState(kDeviceStateSpeaking);
                     }
-                });
+                }, "tts_start");
             } else if (strcmp(state->valuestring, "stop") == 0) {
                 Schedule([this]() {
-                    if (device_state_ == kDeviceStateSpeaking) {
-                        background_task_.WaitForCompletion();
-                        if (keep_listening_) {
-                            protocol_->SendStartListening(kListeningModeAutoStop);
-                            SetDeviceState(kDeviceStateListening);
-                        } else {
-                            SetDeviceState(kDeviceStateIdle);
-                        }
+                    if (device_state_ == kDeviceStateSpeaking && !tts_stopping_) {
+                        // Play out what is still buffered, OutputAudio finishes the turn
+                        // once the speech ring has run dry
+                        tts_stopping_ = true;
+                        background_task_.Schedule([this]() {
+                            jitter_buffer_.Flush();
+                        }, kBackgroundStreamDecode, kBackgroundPolicyBlock, "tts_flush");
                     }
-                });
+                }, "tts_stop");
             } else if (strcmp(state->valuestring, "sentence_start") == 0) {
                 auto text = cJSON_GetObjectItem(root, "text");
                 if (text != NULL) {
@@ -398,12 +530,50 @@ void Application::Start() {
         }
     });
     SetDeviceState(kDeviceStateIdle);
+#if CONFIG_TASK_STATS_DUMP_INTERVAL_S > 0
+    esp_timer_start_periodic(task_stats_timer_, CONFIG_TASK_STATS_DUMP_INTERVAL_S * 1000000ull);
+#endif
 }
 
-void Application::Schedule(std::function<void()> callback) {
+bool Application::Schedule(TaskCallback&& callback, const char* label) {
     std::lock_guard<std::mutex> lock(mutex_);
-    main_tasks_.push_back(std::move(callback));
+    main_task_stats_.RecordDepth(main_tasks_.size());
+    if (!main_tasks_.Push(MainTask{std::move(callback), esp_timer_get_time(), main_task_stats_.Register(label)})) {
+        dropped_main_tasks_++;
+        ESP_LOGE(TAG, "Main task queue is full, drop task");
+        return false;
+    }
     xEventGroupSetBits(event_group_, SCHEDULE_EVENT);
+    return true;
+}
+
+void Application::DumpTaskStats() {
+    ESP_LOGI(TAG, "Scheduler: heap allocations %lu, main queue %zu/%zu dropped %zu, background queue %zu/%u dropped encode %zu decode %zu",
+        TaskCallback::heap_allocations(), main_tasks_.high_water_mark(), main_tasks_.capacity(),
+        dropped_main_tasks_, background_task_.high_water_mark(), BACKGROUND_TASK_QUEUE_SIZE,
+        background_task_.dropped_tasks(kBackgroundStreamEncode),
+        background_task_.dropped_tasks(kBackgroundStreamDecode));
+    ESP_LOGI(TAG, "Playback: underruns %lu, jitter buffer underruns %lu lost %lu, FEC recovered %lu concealed %lu, loss %d%%",
+        tts_ring_.underruns(), jitter_buffer_.underruns(), jitter_buffer_.lost_packets(),
+        opus_decoder_->recovered_frames(), opus_decoder_->concealed_frames(), protocol_->packet_loss_percent());
+    main_task_stats_.Dump();
+    background_task_.stats().Dump();
+
+    // p90 stage time as a share of the audio it handles, 100% means no longer real time
+    auto load = [this](AudioStage stage, int frame_ms) {
+        return audio_stats_.run(stage).Percentile(90) / (frame_ms * 10.0f);
+    };
+    audio_stats_.Dump();
+    ESP_LOGI(TAG, "Audio load p90: input resample %.1f%%, feed %.1f%%, decode %.1f%%, output resample %.1f%%",
+        load(kAudioStageInputResample, AUDIO_CODEC_INPUT_FRAME_DURATION_MS),
+        load(kAudioStageFeed, AUDIO_CODEC_INPUT_FRAME_DURATION_MS),
+        load(kAudioStageDecode, jitter_buffer_.frame_duration_ms()),
+        load(kAudioStageOutputResample, jitter_buffer_.frame_duration_ms()));
+
+    // The next dump covers only what happens from now on
+    main_task_stats_.Reset();
+    background_task_.stats().Reset();
+    audio_stats_.Reset();
 }
 
 // The Main Loop controls the chat state and websocket connection
@@ -422,11 +592,19 @@ void Application::MainLoop() {
             OutputAudio();
         }
         if (bits & SCHEDULE_EVENT) {
-            mutex_.lock();
-            std::list<std::function<void()>> tasks = std::move(main_tasks_);
-            mutex_.unlock();
-            for (auto& task : tasks) {
-                task();
+            MainTask task;
+            while (true) {
+                mutex_.lock();
+                bool has_task = main_tasks_.Pop(task);
+                mutex_.unlock();
+                if (!has_task) {
+                    break;
+                }
+                auto start_time = esp_timer_get_time();
+                main_task_stats_.RecordWait(task.label, start_time - task.enqueue_time);
+                task.callback();
+                main_task_stats_.RecordRun(task.label, esp_timer_get_time() - start_time);
+                task.callback = nullptr;
             }
         }
     }
@@ -438,21 +616,55 @@ void Application::SetActionState(ActionState newState)
     action_state_ = newState; 
 }
 
+// Only called after the background tasks are cancelled, so nothing is consuming the decode queue
 void Application::ResetDecoder() {
-    std::lock_guard<std::mutex> lock(mutex_);
     opus_decoder_->ResetState();
-    audio_decode_queue_.clear();
+    audio_decode_queue_.Clear();
+    jitter_buffer_.Reset();
+    jitter_buffer_.SetFrameDuration(protocol_->server_frame_duration());
+    tts_ring_.Clear();
     last_output_time_ = std::chrono::steady_clock::now();
     Board::GetInstance().GetAudioCodec()->EnableOutput(true);
 }
 
+// Short frames on a clean link for the lowest latency. On a lossy one fewer, longer
+// packets leave more of the bitrate to FEC and lose less to headers.
+int Application::SelectFrameDuration() {
+#if CONFIG_UPLINK_FRAME_DURATION_20
+    return 20;
+#elif CONFIG_UPLINK_FRAME_DURATION_40
+    return 40;
+#elif CONFIG_UPLINK_FRAME_DURATION_60
+    return 60;
+#else
+    int loss = protocol_->packet_loss_percent();
+    if (loss < OPUS_FRAME_DURATION_LOSSY_PERCENT) {
+        return 20;
+    }
+    return loss < OPUS_FRAME_DURATION_BAD_PERCENT ? 40 : OPUS_FRAME_DURATION_MS;
+#endif
+}
+
+// The frame duration is fixed for a session, it goes out in the client hello
+bool Application::OpenAudioChannel() {
+    int frame_duration = SelectFrameDuration();
+    ESP_LOGI(TAG, "Uplink frame duration %d ms, loss %d%%", frame_duration, protocol_->packet_loss_percent());
+    protocol_->SetFrameDuration(frame_duration);
+    opus_encoder_->SetFrameDuration(frame_duration);
+    return protocol_->OpenAudioChannel();
+}
+
 void Application::OutputAudio() {
     auto now = std::chrono::steady_clock::now();
     auto codec = Board::GetInstance().GetAudioCodec();
     const int max_silence_seconds = 10;
 
-    std::unique_lock<std::mutex> lock(mutex_);
-    if (audio_decode_queue_.empty()) {
+    bool speech = !audio_decode_queue_.empty() || !jitter_buffer_.empty();
+    if (tts_stopping_ && !speech && tts_ring_.size() == 0 && device_state_ == kDeviceStateSpeaking) {
+        FinishSpeaking();
+        return;
+    }
+    if (!speech && !clip_pending_) {
         // Disable the output if there is no audio data for a long time
         if (device_state_ == kDeviceStateIdle) {
             auto duration = std::chrono::duration_cast<std::chrono::seconds>(now - last_output_time_).count();
@@ -463,110 +675,318 @@ void Application::OutputAudio() {
         return;
     }
 
-    if (device_state_ == kDeviceStateListening) {
-        audio_decode_queue_.clear();
-        return;
+    last_output_time_ = now;
+    if (speech && device_state_ == kDeviceStateListening) {
+        // The decode stream is the only consumer of the decode queue
+        background_task_.Schedule([this]() {
+            audio_decode_queue_.Clear();
+            jitter_buffer_.Reset();
+            tts_ring_.Clear();
+        }, kBackgroundStreamDecode, kBackgroundPolicyCoalesce, "decode_reset");
+        speech = false;
     }
 
-    last_output_time_ = now;
-    auto opus = std::move(audio_decode_queue_.front());
-    audio_decode_queue_.pop_front();
-    lock.unlock();
+    bool speech_needed = speech && tts_ring_.size() < playback_ahead_samples_;
+    bool clip_needed = clip_pending_ && clip_ring_.size() < playback_ahead_samples_;
+    if (!speech_needed && !clip_needed) {
+        return;
+    }
+    background_task_.Schedule([this]() {
+        DecodeClip();
+        if (device_state_ != kDeviceStateListening) {
+            DecodeAhead();
+        }
+    }, kBackgroundStreamDecode, kBackgroundPolicyDropNewest, "decode");
+}
 
-    background_task_.Schedule([this, codec, opus = std::move(opus)]() mutable {
+// Runs on the decode stream, decodes until the speech ring holds the target amount.
+// After an abort the remaining packets are dropped without decoding them.
+void Application::DecodeAhead() {
+    // Missing packets are only waited for while the speaker has a frame to spare
+    auto codec = Board::GetInstance().GetAudioCodec();
+    size_t spare_samples = codec->output_sample_rate() / 1000 * jitter_buffer_.frame_duration_ms();
+    while (tts_ring_.size() < playback_ahead_samples_) {
         if (aborted_) {
+            audio_decode_queue_.Clear();
+            jitter_buffer_.Reset();
             return;
         }
+        size_t size;
+        uint32_t sequence, timestamp;
+        const uint8_t* packet;
+        while ((packet = audio_decode_queue_.Front(size, &sequence, &timestamp)) != nullptr) {
+            if (!jitter_buffer_.HasRoomFor(sequence)) {
+                break;
+            }
+            jitter_buffer_.Put(packet, size, sequence, timestamp);
+            audio_decode_queue_.Pop();
+        }
 
-        std::vector<int16_t> pcm;
-        if (!opus_decoder_->Decode(std::move(opus), pcm)) {
+        bool starving = tts_ring_.size() < spare_samples;
+        uint32_t now_ms = esp_timer_get_time() / 1000;
+        auto result = jitter_buffer_.Get(decode_packet_, now_ms, starving);
+        if (result == kJitterBufferBuffering) {
             return;
         }
 
-        // Resample if the sample rate is different
-        if (opus_decode_sample_rate_ != codec->output_sample_rate()) {
-            int target_size = output_resampler_.GetOutputSamples(pcm.size());
-            std::vector<int16_t> resampled(target_size);
-            output_resampler_.Process(pcm.data(), pcm.size(), resampled.data());
-            pcm = std::move(resampled);
+        auto start_time = esp_timer_get_time();
+        bool decoded;
+        if (result == kJitterBufferLost) {
+            // The following packet may carry the lost frame as FEC data
+            size_t next_size;
+            auto next = jitter_buffer_.Peek(next_size);
+            decoded = opus_decoder_->Recover(next, next_size, decode_pcm_);
+        } else {
+            decoded = opus_decoder_->Decode(decode_packet_.data(), decode_packet_.size(), decode_pcm_);
         }
-        
-        codec->OutputData(pcm);
-    });
+        if (!decoded) {
+            return;
+        }
+        audio_stats_.RecordRun(kAudioStageDecode, esp_timer_get_time() - start_time);
+        WriteVoice(tts_ring_, output_resampler_, opus_decode_sample_rate_, decode_pcm_);
+    }
+}
+
+// Runs on the decode stream, tops up the clip voice from the remaining .p3 packets
+void Application::DecodeClip() {
+    while (clip_data_ < clip_end_ && clip_ring_.size() < playback_ahead_samples_) {
+        auto p3 = (const BinaryProtocol3*)clip_data_;
+        auto payload_size = ntohs(p3->payload_size);
+        clip_data_ += sizeof(BinaryProtocol3) + payload_size;
+
+        clip_packet_.assign(p3->payload, p3->payload + payload_size);
+        if (clip_decoder_->Decode(std::move(clip_packet_), decode_pcm_)) {
+            WriteVoice(clip_ring_, clip_resampler_, 16000, decode_pcm_);
+        }
+    }
+    clip_pending_ = clip_data_ < clip_end_;
+}
+
+// Resamples decoded PCM to the codec rate if needed and queues it on a mixer voice
+void Application::WriteVoice(PlaybackRing& ring, PolyphaseResampler& resampler, int sample_rate, std::vector<int16_t>& pcm) {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    std::vector<int16_t>* output = &pcm;
+    if (sample_rate != codec->output_sample_rate()) {
+        auto start_time = esp_timer_get_time();
+        decode_resampled_.resize(resampler.GetOutputSamples(pcm.size()));
+        size_t samples = resampler.Process(pcm.data(), pcm.size(), decode_resampled_.data());
+        decode_resampled_.resize(samples);
+        output = &decode_resampled_;
+        audio_stats_.RecordRun(kAudioStageOutputResample, esp_timer_get_time() - start_time);
+    }
+
+    if (ring.Write(output->data(), output->size()) < output->size()) {
+        ESP_LOGW(TAG, "Playback ring is full, drop decoded audio");
+    }
+    xTaskNotifyGive(playback_task_);
+}
+
+// Mixes the voices into the codec one DMA buffer at a time. The write blocks until the
+// DMA has room, so this task follows the I2S clock and never waits on the decoder
+void Application::PlaybackTask() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    std::vector<int16_t> pcm(AUDIO_CODEC_OUTPUT_DMA_FRAME_NUM);
+    bool playing = false;
+    while (true) {
+        auto samples = mixer_.Mix(pcm.data(), pcm.size());
+        if (samples == 0) {
+            // Ran dry while the stream still has packets to decode
+            if (playing && (!jitter_buffer_.empty() || !audio_decode_queue_.empty())) {
+                tts_ring_.CountUnderrun();
+            }
+            playing = false;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            continue;
+        }
+
+        playing = true;
+        codec->OutputData(pcm.data(), samples);
+        LatencyTracer::GetInstance().Mark(kLatencyTraceFirstAudioPlayed);
+    }
+}
+
+void Application::InitializeInputBuffers() {
+    auto codec = Board::GetInstance().GetAudioCodec();
+    int channels = codec->input_channels();
+    input_frame_samples_ = codec->input_frame_samples();
+    int frames = input_frame_samples_ / channels;
+    int resampled_frames = frames;
+    if (codec->input_sample_rate() != 16000) {
+        resampled_frames = input_resampler_.GetOutputSamples(frames);
+    }
+
+    // Room for every buffer below plus alignment padding
+    size_t samples = input_frame_samples_ + frames * 2 + resampled_frames * 2 + resampled_frames * channels;
+    input_arena_.Initialize(samples * sizeof(int16_t) + 6 * 16);
+    input_frame_ = input_arena_.Allocate(input_frame_samples_);
+    input_mic_ = input_arena_.Allocate(frames);
+    input_ref_ = input_arena_.Allocate(frames);
+    input_resampled_mic_ = input_arena_.Allocate(resampled_frames);
+    input_resampled_ref_ = input_arena_.Allocate(resampled_frames);
+    input_resampled_ = input_arena_.Allocate(resampled_frames * channels);
+
+#if !CONFIG_IDF_TARGET_ESP32S3
+    audio_encode_queue_ = std::make_unique<PacketRing>(AUDIO_ENCODE_QUEUE_CAPACITY,
+        resampled_frames * channels * sizeof(int16_t));
+    encode_pcm_.reserve(resampled_frames * channels);
+#endif
 }
 
 void Application::InputAudio() {
     auto codec = Board::GetInstance().GetAudioCodec();
-    std::vector<int16_t> data;
-    if (!codec->InputData(data)) {
+    if (!codec->InputData(input_frame_, input_frame_samples_)) {
         return;
     }
 
+    const int16_t* data = input_frame_;
+    size_t samples = input_frame_samples_;
     if (codec->input_sample_rate() != 16000) {
+        auto start_time = esp_timer_get_time();
         if (codec->input_channels() == 2) {
-            auto mic_channel = std::vector<int16_t>(data.size() / 2);
-            auto reference_channel = std::vector<int16_t>(data.size() / 2);
-            for (size_t i = 0, j = 0; i < mic_channel.size(); ++i, j += 2) {
-                mic_channel[i] = data[j];
-                reference_channel[i] = data[j + 1];
-            }
-            auto resampled_mic = std::vector<int16_t>(input_resampler_.GetOutputSamples(mic_channel.size()));
-            auto resampled_reference = std::vector<int16_t>(reference_resampler_.GetOutputSamples(reference_channel.size()));
-            input_resampler_.Process(mic_channel.data(), mic_channel.size(), resampled_mic.data());
-            reference_resampler_.Process(reference_channel.data(), reference_channel.size(), resampled_reference.data());
-            data.resize(resampled_mic.size() + resampled_reference.size());
-            for (size_t i = 0, j = 0; i < resampled_mic.size(); ++i, j += 2) {
-                data[j] = resampled_mic[i];
-                data[j + 1] = resampled_reference[i];
-            }
+            size_t frames = samples / 2;
+            audio_kernels::DeinterleaveStereo(data, input_mic_, input_ref_, frames);
+            size_t resampled_frames = input_resampler_.Process(input_mic_, frames, input_resampled_mic_);
+            reference_resampler_.Process(input_ref_, frames, input_resampled_ref_);
+            audio_kernels::InterleaveStereo(input_resampled_mic_, input_resampled_ref_, input_resampled_, resampled_frames);
+            samples = resampled_frames * 2;
         } else {
-            auto resampled = std::vector<int16_t>(input_resampler_.GetOutputSamples(data.size()));
-            input_resampler_.Process(data.data(), data.size(), resampled.data());
-            data = std::move(resampled);
+            samples = input_resampler_.Process(data, samples, input_resampled_);
         }
+        data = input_resampled_;
+        audio_stats_.RecordRun(kAudioStageInputResample, esp_timer_get_time() - start_time);
     }
     
 #if CONFIG_IDF_TARGET_ESP32S3
-    if (audio_processor_.IsRunning()) {
-        audio_processor_.Input(data);
-    }
-    if (wake_word_detect_.IsDetectionRunning()) {
-        wake_word_detect_.Feed(data);
+    if (audio_processor_.IsRunning() || wake_word_detect_.IsDetectionRunning()) {
+        auto start_time = esp_timer_get_time();
+        audio_front_end_.Feed(data, samples);
+        audio_stats_.RecordRun(kAudioStageFeed, esp_timer_get_time() - start_time);
     }
 #else
     if (device_state_ == kDeviceStateListening) {
-        background_task_.Schedule([this, data = std::move(data)]() mutable {
-            opus_encoder_->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                Schedule([this, opus = std::move(opus)]() {
-                    protocol_->SendAudio(opus);
+        if (!audio_encode_queue_->Push((const uint8_t*)data, samples * sizeof(int16_t))) {
+            ESP_LOGW(TAG, "Encode queue is full, drop input frame");
+            return;
+        }
+        background_task_.Schedule([this]() {
+            size_t size;
+            const uint8_t* frame;
+            while ((frame = audio_encode_queue_->Front(size)) != nullptr) {
+                auto pcm = (const int16_t*)frame;
+                encode_pcm_.assign(pcm, pcm + size / sizeof(int16_t));
+                audio_encode_queue_->Pop();
+#if CONFIG_UPLINK_SILENCE_GATE
+                uplink_gate_.Analyze(encode_pcm_.data(), encode_pcm_.size());
+#endif
+                opus_encoder_->Encode(std::move(encode_pcm_), [this](const std::vector<uint8_t>& opus) {
+#if CONFIG_UPLINK_SILENCE_GATE
+                    if (!uplink_gate_.Accept(opus.size(), opus_encoder_->duration_ms())) {
+                        return;
+                    }
+#endif
+                    QueueAudioSend(opus);
                 });
-            });
-        });
+            }
+        }, kBackgroundStreamEncode, kBackgroundPolicyCoalesce, "encode");
     }
 #endif
 }
 
+// Runs on the encode stream, the packet is copied into the send queue because the
+// encoder reuses its buffer, and the main loop sends everything queued in order
+void Application::QueueAudioSend(const std::vector<uint8_t>& opus) {
+    if (!audio_send_queue_.Push(opus.data(), opus.size())) {
+        ESP_LOGW(TAG, "Send queue is full, drop audio packet");
+        return;
+    }
+    Schedule([this]() {
+        size_t size;
+        const uint8_t* packet;
+        while ((packet = audio_send_queue_.Front(size)) != nullptr) {
+            send_packet_.assign(packet, packet + size);
+            audio_send_queue_.Pop();
+            protocol_->SendAudio(send_packet_);
+        }
+    }, "send_audio");
+}
+
+// The reply has been played to the end
+void Application::FinishSpeaking() {
+    ESP_LOGI(TAG, "Decode queue high water mark: %zu/%zu, dropped: %zu",
+        audio_decode_queue_.high_water_mark(), audio_decode_queue_.capacity(),
+        audio_decode_queue_.dropped_packets());
+    audio_decode_queue_.ResetStatistics();
+    ESP_LOGI(TAG, "Jitter buffer: jitter %d ms, target %d ms, lost %lu, late %lu, reordered %lu, underruns %lu",
+        jitter_buffer_.jitter_ms(), jitter_buffer_.target_delay_ms(), jitter_buffer_.lost_packets(),
+        jitter_buffer_.late_packets(), jitter_buffer_.reordered_packets(), jitter_buffer_.underruns());
+    jitter_buffer_.ResetStatistics();
+    if (keep_listening_) {
+        LatencyTracer::GetInstance().StartSession();
+        protocol_->SendStartListening(kListeningModeAutoStop);
+        SetDeviceState(kDeviceStateListening);
+    } else {
+        SetDeviceState(kDeviceStateIdle);
+    }
+}
+
 void Application::AbortSpeaking(AbortReason reason) {
     ESP_LOGI(TAG, "Abort speaking");
     aborted_ = true;
+    tts_ring_.Clear();
     protocol_->SendAbortSpeaking(reason);
 }
 
+#if CONFIG_ENDPOINTER_ENABLE
+// The server did not start speaking after the device ended the turn, listen again or
+// give up instead of waiting in listening with the uplink stopped
+void Application::OnEndpointTimeout() {
+    if (device_state_ != kDeviceStateListening || !endpoint_pending_) {
+        return;
+    }
+    endpoint_pending_ = false;
+    ESP_LOGW(TAG, "No response %d ms after the end of speech", CONFIG_ENDPOINTER_RESPONSE_TIMEOUT_MS);
+    if (keep_listening_) {
+        LatencyTracer::GetInstance().StartSession();
+        protocol_->SendStartListening(kListeningModeAutoStop);
+        audio_processor_.Start();
+        endpointer_.Start();
+    } else {
+        SetDeviceState(kDeviceStateIdle);
+    }
+}
+#endif
+
 void Application::SetDeviceState(DeviceState state) {
     if (device_state_ == state) {
         return;
     }
+    if (device_state_ == kDeviceStateListening) {
+        opus_encoder_->LogSession();
+#if CONFIG_UPLINK_SILENCE_GATE
+        uplink_gate_.LogSession();
+#endif
+    }
     device_state_ = state;
+    tts_stopping_ = false;
     ESP_LOGI(TAG, "STATE: %s", STATE_STRINGS[device_state_]);
-    // The state is changed, wait for all background tasks to finish
-    background_task_.WaitForCompletion();
+    // The state is changed, drop the queued audio work of the previous state
+    background_task_.Cancel();
+#if CONFIG_ENDPOINTER_ENABLE
+    endpointer_.Stop();
+    endpoint_pending_ = false;
+    esp_timer_stop(endpoint_timer_);
+#endif
 
     auto display = Board::GetInstance().GetDisplay();
     auto led = Board::GetInstance().GetLed();
     led->OnStateChanged();
     switch (state) {
         case kDeviceStateUnknown:
-        case kDeviceStateIdle:
+        case kDeviceStateIdle: {
+            auto& tracer = LatencyTracer::GetInstance();
+            if (tracer.EndSession()) {
+                ESP_LOGI(TAG, "Latency stats: %s", tracer.GetJson().c_str());
+            }
             display->SetStatus("待命");
             SetActionState(kActionStateSleep);
             display->idle_emtion();
@@ -574,6 +994,7 @@ void Application::SetDeviceState(DeviceState state) {
             audio_processor_.Stop();
 #endif
             break;
+        }
         case kDeviceStateConnecting:
             display->start_emtion();
             break;
@@ -582,8 +1003,20 @@ void Application::SetDeviceState(DeviceState state) {
             display->SetEmotion("neutral");
             ResetDecoder();
             opus_encoder_->ResetState();
+            opus_encoder_->AdaptToPacketLoss(protocol_->packet_loss_percent());
+#if !CONFIG_IDF_TARGET_ESP32S3
+            audio_encode_queue_->Clear();
+#if CONFIG_UPLINK_SILENCE_GATE
+            uplink_gate_.Reset();
+#endif
+#endif
 #if CONFIG_IDF_TARGET_ESP32S3
             audio_processor_.Start();
+#endif
+#if CONFIG_ENDPOINTER_ENABLE
+            if (keep_listening_) {
+                endpointer_.Start();
+            }
 #endif
             UpdateIotStates();
             break;
@@ -606,7 +1039,7 @@ void Application::SetDecodeSampleRate(int sample_rate) {
     }
 
     opus_decode_sample_rate_ = sample_rate;
-    opus_decoder_ = std::make_unique<OpusDecoderWrapper>(opus_decode_sample_rate_, 1);
+    opus_decoder_ = std::make_unique<OpusDownlinkDecoder>(opus_decode_sample_rate_, 1);
 
     auto codec = Board::GetInstance().GetAudioCodec();
     if (opus_decode_sample_rate_ != codec->output_sample_rate()) {
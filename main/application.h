@@ -4,25 +4,42 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <freertos/task.h>
+#include <esp_timer.h>
 
 #include <string>
 #include <mutex>
-#include <list>
+#include <atomic>
 
 #include <opus_encoder.h>
 #include <opus_decoder.h>
-#include <opus_resampler.h>
 
 #include "protocol.h"
 #include "ota.h"
 #include "background_task.h"
+#include "task_callback.h"
+#include "task_queue.h"
+#include "task_stats.h"
+#include "packet_ring.h"
+#include "jitter_buffer.h"
+#include "playback_ring.h"
+#include "audio_mixer.h"
+#include "audio_frame_arena.h"
+#include "polyphase_resampler.h"
+#include "opus_codec.h"
 
 #if CONFIG_IDF_TARGET_ESP32S3
+#include "audio_front_end.h"
 #include "wake_word_detect.h"
 #include "audio_processor.h"
+#include "endpointer.h"
 #include "pet_dog.h"
+#else
+#include "uplink_gate.h"
 #endif
 
+// Preallocated slots of the main loop task queue
+#define MAIN_TASK_QUEUE_SIZE 32
+
 #define SCHEDULE_EVENT (1 << 0)
 #define AUDIO_INPUT_READY_EVENT (1 << 1)
 #define AUDIO_OUTPUT_READY_EVENT (1 << 2)
@@ -54,7 +71,55 @@ enum ActionState {
     kActionStateStop
 };
 
+// 默认且最长的 Opus 帧长，上行帧长每次会话按网络状况在 20/40/60 ms 中选择
 #define OPUS_FRAME_DURATION_MS 60
+#define OPUS_FRAME_DURATION_LOSSY_PERCENT 2
+#define OPUS_FRAME_DURATION_BAD_PERCENT 10
+
+// 下行 Opus 包队列，S3 放在 PSRAM 中
+// 包按实际大小存放，其他芯片只按常见的 60 ms 包（约 200 字节）预留 16 KB 内部 RAM
+#if CONFIG_IDF_TARGET_ESP32S3
+#define AUDIO_DECODE_QUEUE_CAPACITY 256
+#define AUDIO_DECODE_PACKET_MAX_SIZE 1024
+#define AUDIO_DECODE_QUEUE_BYTES 0
+#else
+#define AUDIO_DECODE_QUEUE_CAPACITY 96
+#define AUDIO_DECODE_PACKET_MAX_SIZE 512
+#define AUDIO_DECODE_QUEUE_BYTES (16 * 1024)
+#endif
+
+// 上行 Opus 包由编码线程交给主循环发送，按实际大小存放
+#define AUDIO_SEND_QUEUE_CAPACITY 16
+#define AUDIO_SEND_QUEUE_BYTES (4 * 1024)
+
+// 抖动缓冲的目标延迟范围，根据网络抖动自适应
+#define JITTER_BUFFER_MIN_DELAY_MS CONFIG_AUDIO_REORDER_HOLD_MS
+#define JITTER_BUFFER_MAX_DELAY_MS 600
+
+// 后台编解码线程，S3 上两个核心各一个
+#if CONFIG_IDF_TARGET_ESP32S3
+#define BACKGROUND_TASK_CORES {0, 1}
+#else
+#define BACKGROUND_TASK_CORES {tskNO_AFFINITY}
+#endif
+
+// Background task streams, each one stays in order
+enum BackgroundStream {
+    kBackgroundStreamDefault,
+    kBackgroundStreamEncode,
+    kBackgroundStreamDecode
+};
+
+// Audio pipeline stages timed into audio_stats_, registered in this order
+enum AudioStage {
+    kAudioStageInputResample,
+    kAudioStageFeed,
+    kAudioStageDecode,
+    kAudioStageOutputResample
+};
+
+// 无 AFE 时待编码的输入帧队列
+#define AUDIO_ENCODE_QUEUE_CAPACITY 8
 
 class Application {
 public:
@@ -72,7 +137,11 @@ public:
     void SetActionState(ActionState newState);
     void SetDeviceState(DeviceState state);
     bool IsVoiceDetected() const { return voice_detected_; }
-    void Schedule(std::function<void()> callback);
+    // label names the call site in the task statistics and must be a string literal
+    bool Schedule(TaskCallback&& callback, const char* label = "default");
+    // Logs the queue and latency statistics of the main loop and the background tasks
+    // since the previous call, then starts new histograms
+    void DumpTaskStats();
     void Alert(const std::string& title, const std::string& message);
     void AbortSpeaking(AbortReason reason);
     void ToggleChatState();
@@ -87,39 +156,113 @@ private:
     ~Application();
 
 #if CONFIG_IDF_TARGET_ESP32S3
+    AudioFrontEnd audio_front_end_;
     WakeWordDetect wake_word_detect_;
     AudioProcessor audio_processor_;
+#if CONFIG_ENDPOINTER_ENABLE
+    Endpointer endpointer_;
+    // Armed when the endpointer ends the turn, cancelled by any state change
+    esp_timer_handle_t endpoint_timer_ = nullptr;
+    bool endpoint_pending_ = false;
+#endif
     PetDog dog;
+#endif
+#if CONFIG_TASK_STATS_DUMP_INTERVAL_S > 0
+    esp_timer_handle_t task_stats_timer_ = nullptr;
 #endif
     Ota ota_;
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
+    struct MainTask {
+        TaskCallback callback;
+        int64_t enqueue_time = 0;
+        uint8_t label = 0;
+    };
+    TaskQueue<MainTask> main_tasks_;
+    size_t dropped_main_tasks_ = 0;
+    TaskStats main_task_stats_;
+    // Run time per frame of each AudioStage
+    TaskStats audio_stats_;
     std::unique_ptr<Protocol> protocol_;
     EventGroupHandle_t event_group_;
     volatile DeviceState device_state_ = kDeviceStateIdle;
     volatile ActionState action_state_ = kActionStateSleep;
     bool keep_listening_ = false;
     bool aborted_ = false;
+    // "tts stop" arrived, the buffered speech is still being played out
+    bool tts_stopping_ = false;
     bool voice_detected_ = false;
     std::string last_iot_states_;
 
     // Audio encode / decode
     BackgroundTask background_task_;
     std::chrono::steady_clock::time_point last_output_time_;
-    std::list<std::vector<uint8_t>> audio_decode_queue_;
+    // Produced by the protocol receive task, consumed by the decode stream
+    PacketRing audio_decode_queue_;
+    std::vector<uint8_t> decode_packet_;
+    JitterBuffer jitter_buffer_;
+    // Produced by the encode stream, sent by the main loop
+    PacketRing audio_send_queue_;
+    std::vector<uint8_t> send_packet_;
 
-    std::unique_ptr<OpusEncoderWrapper> opus_encoder_;
-    std::unique_ptr<OpusDecoderWrapper> opus_decoder_;
+    std::unique_ptr<OpusUplinkEncoder> opus_encoder_;
+    std::unique_ptr<OpusDownlinkDecoder> opus_decoder_;
 
     int opus_decode_sample_rate_ = -1;
-    OpusResampler input_resampler_;
-    OpusResampler reference_resampler_;
-    OpusResampler output_resampler_;
+    PolyphaseResampler input_resampler_;
+    PolyphaseResampler reference_resampler_;
+    PolyphaseResampler output_resampler_;
+    // Owned by the decode stream, keep their capacity between frames
+    std::vector<int16_t> decode_pcm_;
+    std::vector<int16_t> decode_resampled_;
+    // Decoded PCM kept CONFIG_AUDIO_PLAYBACK_AHEAD_MS ahead of the I2S DMA, one ring
+    // per mixer voice
+    PlaybackRing tts_ring_;
+    PlaybackRing clip_ring_;
+    AudioMixer mixer_;
+    size_t playback_ahead_samples_ = 0;
+    TaskHandle_t playback_task_ = nullptr;
+    // Local clip voice, the remaining .p3 packets are owned by the decode stream
+    std::unique_ptr<OpusDecoderWrapper> clip_decoder_;
+    PolyphaseResampler clip_resampler_;
+    const char* clip_data_ = nullptr;
+    const char* clip_end_ = nullptr;
+    std::atomic<bool> clip_pending_{false};
+    std::vector<uint8_t> clip_packet_;
+
+    // Capture buffers, carved out of input_arena_ once so InputAudio never allocates
+    AudioFrameArena input_arena_;
+    int input_frame_samples_ = 0;
+    int16_t* input_frame_ = nullptr;
+    int16_t* input_mic_ = nullptr;
+    int16_t* input_ref_ = nullptr;
+    int16_t* input_resampled_mic_ = nullptr;
+    int16_t* input_resampled_ref_ = nullptr;
+    int16_t* input_resampled_ = nullptr;
+#if !CONFIG_IDF_TARGET_ESP32S3
+    // Produced by the main loop, consumed by the encode stream
+    std::unique_ptr<PacketRing> audio_encode_queue_;
+    std::vector<int16_t> encode_pcm_;
+#if CONFIG_UPLINK_SILENCE_GATE
+    UplinkGate uplink_gate_;
+#endif
+#endif
 
     void MainLoop();
+    void InitializeInputBuffers();
     void InputAudio();
+    void QueueAudioSend(const std::vector<uint8_t>& opus);
     void OutputAudio();
+    void DecodeAhead();
+#if CONFIG_ENDPOINTER_ENABLE
+    void OnEndpointTimeout();
+#endif
+    void DecodeClip();
+    void WriteVoice(PlaybackRing& ring, PolyphaseResampler& resampler, int sample_rate, std::vector<int16_t>& pcm);
+    void PlaybackTask();
     void ResetDecoder();
+    void FinishSpeaking();
+    int SelectFrameDuration();
+    bool OpenAudioChannel();
     void SetDecodeSampleRate(int sample_rate);
     void CheckNewVersion();
 
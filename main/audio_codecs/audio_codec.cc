@@ -4,6 +4,7 @@
 
 #include <esp_log.h>
 #include <cstring>
+#include <algorithm>
 #include <driver/i2s_common.h>
 
 #define TAG "AudioCodec"
@@ -26,16 +27,28 @@ void AudioCodec::OutputData(std::vector<int16_t>& data) {
     Write(data.data(), data.size());
 }
 
+void AudioCodec::OutputData(const int16_t* data, int samples) {
+    Write(data, samples);
+}
+
 bool AudioCodec::InputData(std::vector<int16_t>& data) {
-    int duration = 30;
-    int input_frame_size = input_sample_rate_ / 1000 * duration * input_channels_;
+    data.resize(input_frame_samples());
+    return InputData(data.data(), data.size());
+}
 
-    data.resize(input_frame_size);
-    int samples = Read(data.data(), data.size());
-    if (samples > 0) {
-        return true;
+bool AudioCodec::InputData(int16_t* data, int samples) {
+    return Read(data, samples) > 0;
+}
+
+int AudioCodec::DmaFrameNum(int sample_rate, int max_frames) {
+    int frames = sample_rate / 1000 * AUDIO_CODEC_INPUT_FRAME_DURATION_MS;
+    for (int buffers = 1; buffers <= 16; buffers++) {
+        if (frames % buffers == 0 && frames / buffers <= max_frames) {
+            return frames / buffers;
+        }
     }
-    return false;
+    // No clean split at this rate, reads just span DMA buffers
+    return std::min(AUDIO_CODEC_OUTPUT_DMA_FRAME_NUM, max_frames);
 }
 
 IRAM_ATTR bool AudioCodec::on_sent(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx) {
@@ -11,6 +11,19 @@
 
 #include "board.h"
 
+// Capture frame length, chosen so a read can be handed on without rebuffering: one AFE
+// feed chunk (512 samples at 16 kHz) on the ESP32-S3, one Opus frame elsewhere
+#if CONFIG_IDF_TARGET_ESP32S3
+#define AUDIO_CODEC_INPUT_FRAME_DURATION_MS 32
+#else
+#define AUDIO_CODEC_INPUT_FRAME_DURATION_MS 60
+#endif
+// One DMA buffer holds at most 4092 bytes, 8 bytes per frame with 32 bit stereo slots
+#define AUDIO_CODEC_DMA_MAX_FRAME_NUM 511
+// Output DMA buffers stay short, everything queued in them adds playback latency and
+// still plays after an abort
+#define AUDIO_CODEC_OUTPUT_DMA_FRAME_NUM 240
+
 class AudioCodec {
 public:
     AudioCodec();
@@ -22,7 +35,10 @@ public:
 
     void Start();
     void OutputData(std::vector<int16_t>& data);
+    void OutputData(const int16_t* data, int samples);
     bool InputData(std::vector<int16_t>& data);
+    // Reads one input frame of input_frame_samples() into a caller owned buffer
+    bool InputData(int16_t* data, int samples);
     void OnOutputReady(std::function<bool()> callback);
     void OnInputReady(std::function<bool()> callback);
 
@@ -33,6 +49,14 @@ public:
     inline int input_channels() const { return input_channels_; }
     inline int output_channels() const { return output_channels_; }
     inline int output_volume() const { return output_volume_; }
+    inline int input_frame_samples() const {
+        return input_sample_rate_ / 1000 * AUDIO_CODEC_INPUT_FRAME_DURATION_MS * input_channels_;
+    }
+
+    // DMA buffer length in frames that divides the capture frame, at most max_frames, so
+    // every frame read ends on a DMA buffer boundary. Duplex channels share it with the
+    // output, so they pass AUDIO_CODEC_OUTPUT_DMA_FRAME_NUM
+    static int DmaFrameNum(int sample_rate, int max_frames = AUDIO_CODEC_DMA_MAX_FRAME_NUM);
 
 private:
     std::function<bool()> on_input_ready_;
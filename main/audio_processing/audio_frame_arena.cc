@@ -0,0 +1,39 @@
+#include "audio_frame_arena.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#define TAG "AudioFrameArena"
+#define ARENA_ALIGNMENT 16
+
+AudioFrameArena::~AudioFrameArena() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+bool AudioFrameArena::Initialize(size_t bytes) {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+    size_ = (bytes + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    used_ = 0;
+    buffer_ = (uint8_t*)heap_caps_aligned_alloc(ARENA_ALIGNMENT, size_, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %zu bytes", size_);
+        size_ = 0;
+        return false;
+    }
+    return true;
+}
+
+int16_t* AudioFrameArena::Allocate(size_t samples) {
+    size_t bytes = (samples * sizeof(int16_t) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+    if (used_ + bytes > size_) {
+        ESP_LOGE(TAG, "Arena exhausted, need %zu bytes, %zu left", bytes, size_ - used_);
+        return nullptr;
+    }
+    auto ptr = (int16_t*)(buffer_ + used_);
+    used_ += bytes;
+    return ptr;
+}
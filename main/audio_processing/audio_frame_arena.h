@@ -0,0 +1,28 @@
+#ifndef AUDIO_FRAME_ARENA_H
+#define AUDIO_FRAME_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+// A single 16-byte aligned block carved into the fixed size buffers of one pipeline
+// stage. Buffers are handed out once at setup, the per-frame path never allocates.
+class AudioFrameArena {
+public:
+    AudioFrameArena() = default;
+    ~AudioFrameArena();
+    AudioFrameArena(const AudioFrameArena&) = delete;
+    AudioFrameArena& operator=(const AudioFrameArena&) = delete;
+
+    bool Initialize(size_t bytes);
+    int16_t* Allocate(size_t samples);
+
+    inline size_t size() const { return size_; }
+    inline size_t used() const { return used_; }
+
+private:
+    uint8_t* buffer_ = nullptr;
+    size_t size_ = 0;
+    size_t used_ = 0;
+};
+
+#endif // AUDIO_FRAME_ARENA_H
@@ -0,0 +1,131 @@
+#include "audio_front_end.h"
+#include "audio_codec.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <model_path.h>
+#include <sstream>
+#include <cstring>
+
+static const char* TAG = "AudioFrontEnd";
+
+AudioFrontEnd::~AudioFrontEnd() {
+    if (afe_data_ != nullptr) {
+        esp_afe_sr_v1.destroy(afe_data_);
+    }
+}
+
+void AudioFrontEnd::Initialize(int channels, bool reference) {
+    channels_ = channels;
+    reference_ = reference;
+    int ref_num = reference_ ? 1 : 0;
+
+    srmodel_list_t *models = esp_srmodel_init("model");
+    for (int i = 0; i < models->num; i++) {
+        ESP_LOGI(TAG, "Model %d: %s", i, models->model_name[i]);
+        if (strstr(models->model_name[i], ESP_WN_PREFIX) != NULL) {
+            wakenet_model_ = models->model_name[i];
+            auto words = esp_srmodel_get_wake_words(models, wakenet_model_);
+            // split by ";" to get all wake words
+            std::stringstream ss(words);
+            std::string word;
+            while (std::getline(ss, word, ';')) {
+                wake_words_.push_back(word);
+            }
+        }
+    }
+
+    afe_config_t afe_config = {
+        .aec_init = reference_,
+        .se_init = true,
+        .vad_init = true,
+        .wakenet_init = wakenet_model_ != NULL,
+        .voice_communication_init = false,
+        .voice_communication_agc_init = false,
+        .voice_communication_agc_gain = 10,
+        .vad_mode = VAD_MODE_3,
+        .wakenet_model_name = wakenet_model_,
+        .wakenet_model_name_2 = NULL,
+        .wakenet_mode = DET_MODE_90,
+        .afe_mode = SR_MODE_HIGH_PERF,
+        .afe_perferred_core = 1,
+        .afe_perferred_priority = 1,
+        .afe_ringbuf_size = 50,
+        .memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM,
+        .afe_linear_gain = 1.0,
+        .agc_mode = AFE_MN_PEAK_AGC_MODE_2,
+        .pcm_config = {
+            .total_ch_num = channels_,
+            .mic_num = channels_ - ref_num,
+            .ref_num = ref_num,
+            .sample_rate = 16000
+        },
+        .debug_init = false,
+        .debug_hook = {{ AFE_DEBUG_HOOK_MASE_TASK_IN, NULL }, { AFE_DEBUG_HOOK_FETCH_TASK_IN, NULL }},
+        .afe_ns_mode = NS_MODE_SSP,
+        .afe_ns_model_name = NULL,
+        .fixed_first_channel = true,
+    };
+
+    // Logged so the footprint can be compared with other AFE configurations
+    auto free_psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    auto free_internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+    afe_data_ = esp_afe_sr_v1.create_from_config(&afe_config);
+    ESP_LOGI(TAG, "AFE created, PSRAM used: %u, internal used: %u",
+        free_psram - heap_caps_get_free_size(MALLOC_CAP_SPIRAM),
+        free_internal - heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+
+    auto feed_size = esp_afe_sr_v1.get_feed_chunksize(afe_data_);
+    if (feed_size != 16000 / 1000 * AUDIO_CODEC_INPUT_FRAME_DURATION_MS) {
+        ESP_LOGW(TAG, "Feed chunk of %d samples does not match the capture frame, rebuffering", feed_size);
+    }
+    input_ring_.Initialize(feed_size * channels_, AUDIO_FRONT_END_INPUT_CHUNKS);
+
+    xTaskCreate([](void* arg) {
+        auto this_ = (AudioFrontEnd*)arg;
+        this_->FetchTask();
+        vTaskDelete(NULL);
+    }, "audio_front_end", 4096 * 2, this, 1, nullptr);
+}
+
+void AudioFrontEnd::AddListener(std::function<void(const afe_fetch_result_t* result)> listener) {
+    listeners_.push_back(listener);
+}
+
+void AudioFrontEnd::Feed(const int16_t* data, size_t samples) {
+    // Capture frames match the feed chunk, hand them over without the ring copy
+    if (samples == input_ring_.chunk_samples() && input_ring_.size() == 0) {
+        esp_afe_sr_v1.feed(afe_data_, data);
+        return;
+    }
+
+    input_ring_.Write(data, samples);
+
+    const int16_t* chunk;
+    while ((chunk = input_ring_.Front()) != nullptr) {
+        esp_afe_sr_v1.feed(afe_data_, chunk);
+        input_ring_.Pop();
+    }
+}
+
+void AudioFrontEnd::FetchTask() {
+    auto fetch_size = esp_afe_sr_v1.get_fetch_chunksize(afe_data_);
+    auto feed_size = esp_afe_sr_v1.get_feed_chunksize(afe_data_);
+    ESP_LOGI(TAG, "Audio front end task started, feed size: %d fetch size: %d",
+        feed_size, fetch_size);
+
+    while (true) {
+        // Blocks until a chunk has been fed and processed
+        auto res = esp_afe_sr_v1.fetch(afe_data_);
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            if (res != nullptr) {
+                ESP_LOGI(TAG, "Error code: %d", res->ret_value);
+            }
+            continue;
+        }
+
+        for (auto& listener : listeners_) {
+            listener(res);
+        }
+    }
+}
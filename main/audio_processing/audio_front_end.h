@@ -0,0 +1,48 @@
+#ifndef AUDIO_FRONT_END_H
+#define AUDIO_FRONT_END_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_afe_sr_models.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "chunk_ring.h"
+
+// AFE feed chunks buffered between Feed calls
+#define AUDIO_FRONT_END_INPUT_CHUNKS 4
+
+// The only ESP-SR AFE instance of the device. AEC, noise suppression, VAD and WakeNet
+// run once per chunk and every fetched result is handed to all listeners, the wake
+// word detector and the uplink processor share the same cleaned stream.
+class AudioFrontEnd {
+public:
+    AudioFrontEnd() = default;
+    ~AudioFrontEnd();
+    AudioFrontEnd(const AudioFrontEnd&) = delete;
+    AudioFrontEnd& operator=(const AudioFrontEnd&) = delete;
+
+    void Initialize(int channels, bool reference);
+    // Called from the fetch task with every AFE result, register before the first Feed
+    void AddListener(std::function<void(const afe_fetch_result_t* result)> listener);
+    // Whole feed chunks go straight to the AFE, anything else is rebuffered
+    void Feed(const int16_t* data, size_t samples);
+
+    const std::vector<std::string>& wake_words() const { return wake_words_; }
+
+private:
+    esp_afe_sr_data_t* afe_data_ = nullptr;
+    char* wakenet_model_ = NULL;
+    std::vector<std::string> wake_words_;
+    std::vector<std::function<void(const afe_fetch_result_t* result)>> listeners_;
+    ChunkRing input_ring_;
+    int channels_;
+    bool reference_;
+
+    void FetchTask();
+};
+
+#endif // AUDIO_FRONT_END_H
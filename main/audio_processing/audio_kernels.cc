@@ -0,0 +1,152 @@
+#include "audio_kernels.h"
+
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace audio_kernels {
+
+static inline bool IsAligned(const void* ptr, uintptr_t alignment) {
+    return ((uintptr_t)ptr & (alignment - 1)) == 0;
+}
+
+// Two frames per 32-bit word pair, safe on cores that trap unaligned 32-bit accesses
+// as long as every pointer is 4-byte aligned.
+static size_t DeinterleaveWords(const int16_t* in, int16_t* left, int16_t* right, size_t frames) {
+    if (!IsAligned(in, 4) || !IsAligned(left, 4) || !IsAligned(right, 4)) {
+        return 0;
+    }
+    auto src = (const uint32_t*)in;
+    auto dst_left = (uint32_t*)left;
+    auto dst_right = (uint32_t*)right;
+    size_t pairs = frames / 2;
+    for (size_t i = 0; i < pairs; i++) {
+        uint32_t w0 = src[i * 2];
+        uint32_t w1 = src[i * 2 + 1];
+        dst_left[i] = (w0 & 0xFFFF) | (w1 << 16);
+        dst_right[i] = (w0 >> 16) | (w1 & 0xFFFF0000);
+    }
+    return pairs * 2;
+}
+
+static size_t InterleaveWords(const int16_t* left, const int16_t* right, int16_t* out, size_t frames) {
+    if (!IsAligned(left, 4) || !IsAligned(right, 4) || !IsAligned(out, 4)) {
+        return 0;
+    }
+    auto src_left = (const uint32_t*)left;
+    auto src_right = (const uint32_t*)right;
+    auto dst = (uint32_t*)out;
+    size_t pairs = frames / 2;
+    for (size_t i = 0; i < pairs; i++) {
+        uint32_t l = src_left[i];
+        uint32_t r = src_right[i];
+        dst[i * 2] = (l & 0xFFFF) | (r << 16);
+        dst[i * 2 + 1] = (l >> 16) | (r & 0xFFFF0000);
+    }
+    return pairs * 2;
+}
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// PIE 128-bit loads and stores ignore the low 4 address bits, so these are only
+// used when every buffer is 16-byte aligned. 8 frames per iteration.
+static size_t DeinterleavePie(const int16_t* in, int16_t* left, int16_t* right, size_t frames) {
+    if (!IsAligned(in, 16) || !IsAligned(left, 16) || !IsAligned(right, 16)) {
+        return 0;
+    }
+    size_t blocks = frames / 8;
+    for (size_t i = 0; i < blocks; i++) {
+        asm volatile(
+            "ee.vld.128.ip q0, %0, 16\n"
+            "ee.vld.128.ip q1, %0, 16\n"
+            "ee.vunzip.16 q0, q1\n"
+            "ee.vst.128.ip q0, %1, 16\n"
+            "ee.vst.128.ip q1, %2, 16\n"
+            : "+r"(in), "+r"(left), "+r"(right)
+            :
+            : "memory");
+    }
+    return blocks * 8;
+}
+
+static size_t InterleavePie(const int16_t* left, const int16_t* right, int16_t* out, size_t frames) {
+    if (!IsAligned(left, 16) || !IsAligned(right, 16) || !IsAligned(out, 16)) {
+        return 0;
+    }
+    size_t blocks = frames / 8;
+    for (size_t i = 0; i < blocks; i++) {
+        asm volatile(
+            "ee.vld.128.ip q0, %0, 16\n"
+            "ee.vld.128.ip q1, %1, 16\n"
+            "ee.vzip.16 q0, q1\n"
+            "ee.vst.128.ip q0, %2, 16\n"
+            "ee.vst.128.ip q1, %2, 16\n"
+            : "+r"(left), "+r"(right), "+r"(out)
+            :
+            : "memory");
+    }
+    return blocks * 8;
+}
+#endif
+
+void DeinterleaveStereo(const int16_t* in, int16_t* left, int16_t* right, size_t frames) {
+    size_t done = 0;
+#if CONFIG_IDF_TARGET_ESP32S3
+    done = DeinterleavePie(in, left, right, frames);
+#elif defined(__SSE2__)
+    for (; done + 8 <= frames; done += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(in + done * 2));
+        __m128i b = _mm_loadu_si128((const __m128i*)(in + done * 2 + 8));
+        __m128i l = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+        _mm_storeu_si128((__m128i*)(left + done), l);
+        _mm_storeu_si128((__m128i*)(right + done), r);
+    }
+#elif defined(__ARM_NEON)
+    for (; done + 8 <= frames; done += 8) {
+        int16x8x2_t v = vld2q_s16(in + done * 2);
+        vst1q_s16(left + done, v.val[0]);
+        vst1q_s16(right + done, v.val[1]);
+    }
+#endif
+    if (done == 0) {
+        done = DeinterleaveWords(in, left, right, frames);
+    }
+    for (size_t i = done; i < frames; i++) {
+        left[i] = in[i * 2];
+        right[i] = in[i * 2 + 1];
+    }
+}
+
+void InterleaveStereo(const int16_t* left, const int16_t* right, int16_t* out, size_t frames) {
+    size_t done = 0;
+#if CONFIG_IDF_TARGET_ESP32S3
+    done = InterleavePie(left, right, out, frames);
+#elif defined(__SSE2__)
+    for (; done + 8 <= frames; done += 8) {
+        __m128i l = _mm_loadu_si128((const __m128i*)(left + done));
+        __m128i r = _mm_loadu_si128((const __m128i*)(right + done));
+        _mm_storeu_si128((__m128i*)(out + done * 2), _mm_unpacklo_epi16(l, r));
+        _mm_storeu_si128((__m128i*)(out + done * 2 + 8), _mm_unpackhi_epi16(l, r));
+    }
+#elif defined(__ARM_NEON)
+    for (; done + 8 <= frames; done += 8) {
+        int16x8x2_t v = { vld1q_s16(left + done), vld1q_s16(right + done) };
+        vst2q_s16(out + done * 2, v);
+    }
+#endif
+    if (done == 0) {
+        done = InterleaveWords(left, right, out, frames);
+    }
+    for (size_t i = done; i < frames; i++) {
+        out[i * 2] = left[i];
+        out[i * 2 + 1] = right[i];
+    }
+}
+
+} // namespace audio_kernels
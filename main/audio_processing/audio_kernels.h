@@ -0,0 +1,19 @@
+#ifndef AUDIO_KERNELS_H
+#define AUDIO_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Sample layout kernels used on the capture path. The ESP32-S3 uses PIE vector
+// instructions when all buffers are 16-byte aligned, the host build uses SSE2 or NEON,
+// everything else falls back to a 32-bit word at a time loop.
+namespace audio_kernels {
+
+// in: L0 R0 L1 R1 ... -> left: L0 L1 ..., right: R0 R1 ...
+void DeinterleaveStereo(const int16_t* in, int16_t* left, int16_t* right, size_t frames);
+// left: L0 L1 ..., right: R0 R1 ... -> out: L0 R0 L1 R1 ...
+void InterleaveStereo(const int16_t* left, const int16_t* right, int16_t* out, size_t frames);
+
+} // namespace audio_kernels
+
+#endif // AUDIO_KERNELS_H
@@ -0,0 +1,119 @@
+#include "audio_mixer.h"
+
+#include <esp_log.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "AudioMixer"
+
+static inline int32_t ToQ15(float gain) {
+    return (int32_t)(gain * (1 << 15) + 0.5f);
+}
+
+// Linear below the threshold, above it the excess is compressed as x * k / (x + k)
+// which approaches full scale but never reaches it
+static inline int16_t SoftLimit(int32_t sample) {
+    const int32_t threshold = AUDIO_MIXER_LIMITER_THRESHOLD;
+    const int32_t knee = INT16_MAX - threshold;
+    int32_t magnitude = sample < 0 ? -sample : sample;
+    if (magnitude <= threshold) {
+        return (int16_t)sample;
+    }
+    int32_t excess = magnitude - threshold;
+    magnitude = threshold + (int32_t)((int64_t)excess * knee / (excess + knee));
+    return (int16_t)(sample < 0 ? -magnitude : magnitude);
+}
+
+void AudioMixer::Initialize(int sample_rate) {
+    int ramp_samples = std::max(1, sample_rate / 1000 * AUDIO_MIXER_DUCK_RAMP_MS);
+    duck_step_ = std::max(1, (int)((ToQ15(1.0f) - ToQ15(AUDIO_MIXER_DUCK_GAIN)) / ramp_samples));
+}
+
+int AudioMixer::AddVoice(PlaybackRing* ring, float gain, bool ducked) {
+    if (voice_count_ == AUDIO_MIXER_MAX_VOICES) {
+        ESP_LOGE(TAG, "Too many voices");
+        return -1;
+    }
+    voices_[voice_count_] = { ring, ToQ15(gain), ducked };
+    return voice_count_++;
+}
+
+void AudioMixer::SetGain(int voice, float gain) {
+    voices_[voice].gain = ToQ15(gain);
+}
+
+size_t AudioMixer::Mix(int16_t* out, size_t samples) {
+    size_t mixed = 0;
+    while (mixed < samples) {
+        size_t block = std::min(samples - mixed, (size_t)AUDIO_MIXER_BLOCK_SAMPLES);
+        size_t count = MixBlock(out + mixed, block);
+        mixed += count;
+        if (count < block) {
+            break;
+        }
+    }
+    return mixed;
+}
+
+size_t AudioMixer::MixBlock(int16_t* out, size_t samples) {
+    // Only as much as every playing voice can supply, so a voice that is a little
+    // behind is not padded with silence in the middle of its stream. Ducking follows
+    // the voices that are not ducked themselves.
+    bool priority = false;
+    size_t length = samples;
+    bool playing = false;
+    for (int i = 0; i < voice_count_; i++) {
+        size_t available = voices_[i].ring->size();
+        if (available == 0) {
+            continue;
+        }
+        playing = true;
+        length = std::min(length, available);
+        if (!voices_[i].ducked) {
+            priority = true;
+        }
+    }
+    if (!playing) {
+        return 0;
+    }
+    int32_t duck_target = priority ? ToQ15(AUDIO_MIXER_DUCK_GAIN) : ToQ15(1.0f);
+
+    memset(mix_, 0, length * sizeof(int32_t));
+    for (int i = 0; i < voice_count_; i++) {
+        auto& voice = voices_[i];
+        // A Clear since size() may leave less, the rest stays silent
+        size_t count = voice.ring->Read(voice_pcm_, length);
+        if (count == 0) {
+            continue;
+        }
+
+        if (!voice.ducked) {
+            for (size_t j = 0; j < count; j++) {
+                mix_[j] += (voice_pcm_[j] * voice.gain) >> 15;
+            }
+            continue;
+        }
+        int32_t duck = duck_gain_;
+        for (size_t j = 0; j < count; j++) {
+            if (duck < duck_target) {
+                duck = std::min(duck + duck_step_, duck_target);
+            } else if (duck > duck_target) {
+                duck = std::max(duck - duck_step_, duck_target);
+            }
+            int32_t gain = (voice.gain * duck) >> 15;
+            mix_[j] += (voice_pcm_[j] * gain) >> 15;
+        }
+    }
+
+    // Ducked voices share the ramp, advance it once per block
+    if (duck_gain_ < duck_target) {
+        duck_gain_ = std::min(duck_gain_ + duck_step_ * (int32_t)length, duck_target);
+    } else if (duck_gain_ > duck_target) {
+        duck_gain_ = std::max(duck_gain_ - duck_step_ * (int32_t)length, duck_target);
+    }
+
+    for (size_t j = 0; j < length; j++) {
+        out[j] = SoftLimit(mix_[j]);
+    }
+    return length;
+}
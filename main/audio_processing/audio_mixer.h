@@ -0,0 +1,55 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "playback_ring.h"
+
+#define AUDIO_MIXER_MAX_VOICES 4
+// Samples mixed per pass, larger requests are split
+#define AUDIO_MIXER_BLOCK_SAMPLES 512
+// Gain of the ducked voices while a priority voice plays, about -12 dB
+#define AUDIO_MIXER_DUCK_GAIN 0.25f
+#define AUDIO_MIXER_DUCK_RAMP_MS 20
+// The limiter leaves samples below this level untouched, about -3 dBFS
+#define AUDIO_MIXER_LIMITER_THRESHOLD 23170
+
+// Mixes the PCM of several playback rings for the speaker. Every voice has its own
+// gain, voices marked as ducked are turned down while any other voice is playing,
+// and a soft knee limiter keeps the sum inside 16 bits without hard clipping.
+// Mix is called from the playback task only.
+class AudioMixer {
+public:
+    AudioMixer() = default;
+    AudioMixer(const AudioMixer&) = delete;
+    AudioMixer& operator=(const AudioMixer&) = delete;
+
+    void Initialize(int sample_rate);
+    // Returns the voice index, call before the first Mix
+    int AddVoice(PlaybackRing* ring, float gain, bool ducked);
+    void SetGain(int voice, float gain);
+
+    // Mixes up to samples into out, no more than every voice with queued PCM can
+    // supply, so no voice is padded with silence. Returns the samples written, 0 when
+    // all voices are empty.
+    size_t Mix(int16_t* out, size_t samples);
+
+private:
+    struct Voice {
+        PlaybackRing* ring;
+        int32_t gain; // Q15
+        bool ducked;
+    };
+
+    Voice voices_[AUDIO_MIXER_MAX_VOICES];
+    int voice_count_ = 0;
+    int32_t duck_gain_ = 1 << 15; // Q15, ramps between 1 and AUDIO_MIXER_DUCK_GAIN
+    int32_t duck_step_ = 1;
+    int32_t mix_[AUDIO_MIXER_BLOCK_SAMPLES];
+    int16_t voice_pcm_[AUDIO_MIXER_BLOCK_SAMPLES];
+
+    size_t MixBlock(int16_t* out, size_t samples);
+};
+
+#endif // AUDIO_MIXER_H
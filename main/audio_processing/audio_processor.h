@@ -1,22 +1,22 @@
 #ifndef AUDIO_PROCESSOR_H
 #define AUDIO_PROCESSOR_H
 
-#include <esp_afe_sr_models.h>
 #include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
 #include <freertos/event_groups.h>
 
 #include <string>
 #include <vector>
 #include <functional>
 
+#include "audio_front_end.h"
+
+// Uplink branch of the shared front end, forwards the cleaned audio while started
 class AudioProcessor {
 public:
     AudioProcessor();
     ~AudioProcessor();
 
-    void Initialize(int channels, bool reference);
-    void Input(const std::vector<int16_t>& data);
+    void Initialize(AudioFrontEnd& front_end);
     void Start();
     void Stop();
     bool IsRunning();
@@ -24,13 +24,9 @@ public:
 
 private:
     EventGroupHandle_t event_group_ = nullptr;
-    esp_afe_sr_data_t* afe_communication_data_ = nullptr;
-    std::vector<int16_t> input_buffer_;
     std::function<void(std::vector<int16_t>&& data)> output_callback_;
-    int channels_;
-    bool reference_;
 
-    void AudioProcessorTask();
+    void Process(const afe_fetch_result_t* result);
 };
 
 #endif
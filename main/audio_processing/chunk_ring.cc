@@ -0,0 +1,73 @@
+#include "chunk_ring.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "ChunkRing"
+
+ChunkRing::~ChunkRing() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+bool ChunkRing::Initialize(size_t chunk_samples, size_t chunk_count) {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+    chunk_samples_ = chunk_samples;
+    capacity_ = chunk_samples * chunk_count;
+    // The AFE reads every chunk right after it is complete, keep it in internal RAM if possible
+    buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (buffer_ == nullptr) {
+        buffer_ = (int16_t*)heap_caps_malloc(capacity_ * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    }
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %zu samples", capacity_);
+        capacity_ = 0;
+        return false;
+    }
+    Reset();
+    return true;
+}
+
+void ChunkRing::Write(const int16_t* data, size_t samples) {
+    if (capacity_ == 0) {
+        return;
+    }
+    while (samples > 0) {
+        if (size_ == capacity_) {
+            // Nobody consumed the oldest chunk in time, drop it
+            read_ = (read_ + chunk_samples_) % capacity_;
+            size_ -= chunk_samples_;
+            dropped_chunks_++;
+        }
+        size_t write = (read_ + size_) % capacity_;
+        size_t count = std::min(samples, std::min(capacity_ - write, capacity_ - size_));
+        memcpy(buffer_ + write, data, count * sizeof(int16_t));
+        data += count;
+        samples -= count;
+        size_ += count;
+    }
+}
+
+const int16_t* ChunkRing::Front() const {
+    if (size_ < chunk_samples_ || capacity_ == 0) {
+        return nullptr;
+    }
+    return buffer_ + read_;
+}
+
+void ChunkRing::Pop() {
+    if (size_ >= chunk_samples_) {
+        read_ = (read_ + chunk_samples_) % capacity_;
+        size_ -= chunk_samples_;
+    }
+}
+
+void ChunkRing::Reset() {
+    read_ = 0;
+    size_ = 0;
+}
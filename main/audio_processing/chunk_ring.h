@@ -0,0 +1,41 @@
+#ifndef CHUNK_RING_H
+#define CHUNK_RING_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Circular sample buffer whose capacity is a whole number of chunks, so every
+// complete chunk is contiguous and can be handed to the AFE feed in place.
+// Samples are copied in once and never moved. Not thread safe.
+class ChunkRing {
+public:
+    ChunkRing() = default;
+    ~ChunkRing();
+    ChunkRing(const ChunkRing&) = delete;
+    ChunkRing& operator=(const ChunkRing&) = delete;
+
+    // chunk_samples counts the samples of all channels
+    bool Initialize(size_t chunk_samples, size_t chunk_count);
+
+    // Overwrites the oldest complete chunk if the ring is full
+    void Write(const int16_t* data, size_t samples);
+    // The oldest complete chunk or nullptr, valid until the next Pop, Write or Reset
+    const int16_t* Front() const;
+    void Pop();
+    void Reset();
+
+    inline size_t chunk_samples() const { return chunk_samples_; }
+    inline size_t size() const { return size_; }
+    inline size_t dropped_chunks() const { return dropped_chunks_; }
+
+private:
+    int16_t* buffer_ = nullptr;
+    size_t chunk_samples_ = 0;
+    size_t capacity_ = 0;
+    // read_ is always chunk aligned
+    size_t read_ = 0;
+    size_t size_ = 0;
+    size_t dropped_chunks_ = 0;
+};
+
+#endif // CHUNK_RING_H
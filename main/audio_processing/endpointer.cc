@@ -0,0 +1,57 @@
+#include "endpointer.h"
+
+#include <esp_log.h>
+#include <cmath>
+
+#define TAG "Endpointer"
+
+Endpointer::Endpointer(const EndpointerConfig& config) : config_(config) {
+    // Mean square of a full scale signal at the threshold level
+    double amplitude = 32768.0 * std::pow(10.0, config_.energy_threshold_dbfs / 20.0);
+    energy_threshold_ = (int64_t)(amplitude * amplitude);
+}
+
+void Endpointer::Start() {
+    restart_.store(true, std::memory_order_relaxed);
+    active_.store(true, std::memory_order_release);
+}
+
+void Endpointer::Stop() {
+    active_.store(false, std::memory_order_release);
+}
+
+bool Endpointer::Process(bool vad_speech, const int16_t* pcm, size_t samples) {
+    if (!active_.load(std::memory_order_acquire) || samples == 0) {
+        return false;
+    }
+    if (restart_.exchange(false, std::memory_order_relaxed)) {
+        speech_ms_ = 0;
+        silence_ms_ = 0;
+    }
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < samples; i++) {
+        sum += (int32_t)pcm[i] * pcm[i];
+    }
+    bool speech = vad_speech && sum / (int64_t)samples >= energy_threshold_;
+    int frame_ms = (int)(samples * 1000 / config_.sample_rate);
+
+    if (speech) {
+        speech_ms_ += frame_ms;
+        silence_ms_ = 0;
+        return false;
+    }
+    // Leading silence never ends the turn, the server still decides when nobody speaks
+    if (speech_ms_ < config_.min_speech_ms) {
+        speech_ms_ = 0;
+        return false;
+    }
+    silence_ms_ += frame_ms;
+    if (silence_ms_ < config_.hangover_ms) {
+        return false;
+    }
+
+    ESP_LOGI(TAG, "End of speech after %d ms of speech and %d ms of silence", speech_ms_, silence_ms_);
+    active_.store(false, std::memory_order_relaxed);
+    return true;
+}
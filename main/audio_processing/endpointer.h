@@ -0,0 +1,44 @@
+#ifndef ENDPOINTER_H
+#define ENDPOINTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+struct EndpointerConfig {
+    int sample_rate = 16000;
+    // Speech that has to be seen before an endpoint can be detected
+    int min_speech_ms = 200;
+    // Trailing silence that ends the utterance
+    int hangover_ms = 700;
+    // Frames quieter than this count as silence even if the VAD says speech
+    int energy_threshold_dbfs = -50;
+};
+
+// Decides on the device when the user has finished speaking, from the AFE VAD
+// decision and the frame energy. Start / Stop may be called from any task,
+// Process only from the task that produces the audio.
+class Endpointer {
+public:
+    explicit Endpointer(const EndpointerConfig& config = EndpointerConfig());
+
+    // Arms the endpointer for a new utterance
+    void Start();
+    void Stop();
+    inline bool active() const { return active_.load(std::memory_order_relaxed); }
+
+    // Returns true once, on the frame that ends the utterance
+    bool Process(bool vad_speech, const int16_t* pcm, size_t samples);
+
+    inline int speech_ms() const { return speech_ms_; }
+
+private:
+    EndpointerConfig config_;
+    int64_t energy_threshold_;
+    std::atomic<bool> active_{false};
+    std::atomic<bool> restart_{false};
+    int speech_ms_ = 0;
+    int silence_ms_ = 0;
+};
+
+#endif // ENDPOINTER_H
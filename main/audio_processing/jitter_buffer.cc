@@ -0,0 +1,204 @@
+#include "jitter_buffer.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "JitterBuffer"
+
+JitterBuffer::JitterBuffer(int frame_duration_ms, int min_delay_ms, int max_delay_ms, size_t max_packet_size)
+    : frame_duration_ms_(frame_duration_ms), min_delay_ms_(min_delay_ms), max_delay_ms_(max_delay_ms),
+      max_packet_size_(max_packet_size), target_delay_ms_(min_delay_ms) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    buffer_ = (uint8_t*)heap_caps_malloc(kWindowSize * max_packet_size_, MALLOC_CAP_SPIRAM);
+#endif
+    if (buffer_ == nullptr) {
+        buffer_ = (uint8_t*)heap_caps_malloc(kWindowSize * max_packet_size_, MALLOC_CAP_8BIT);
+    }
+    ClearSlots();
+}
+
+JitterBuffer::~JitterBuffer() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+void JitterBuffer::ClearSlots() {
+    memset(slot_used_, 0, sizeof(slot_used_));
+    count_.store(0, std::memory_order_relaxed);
+}
+
+void JitterBuffer::Reset() {
+    ClearSlots();
+    synced_ = false;
+    playing_ = false;
+    starved_ = false;
+    started_ = false;
+    flushing_ = false;
+    gap_pending_ = false;
+    has_last_arrival_ = false;
+}
+
+void JitterBuffer::ResetStatistics() {
+    lost_packets_ = 0;
+    late_packets_ = 0;
+    reordered_packets_ = 0;
+    underruns_ = 0;
+}
+
+// RFC 3550 style interarrival jitter, only packets arriving later than their
+// nominal spacing count, a server sending ahead of real time is not jitter.
+void JitterBuffer::UpdateJitter(uint32_t sequence, uint32_t arrival_ms) {
+    if (has_last_arrival_ && (int32_t)(sequence - last_arrival_sequence_) > 0) {
+        int32_t expected = (int32_t)(sequence - last_arrival_sequence_) * frame_duration_ms_;
+        int32_t delay = (int32_t)(arrival_ms - last_arrival_ms_) - expected;
+        jitter_ms_ += ((float)std::max<int32_t>(delay, 0) - jitter_ms_) / 16.0f;
+    }
+    if (!has_last_arrival_ || (int32_t)(sequence - last_arrival_sequence_) > 0) {
+        has_last_arrival_ = true;
+        last_arrival_sequence_ = sequence;
+        last_arrival_ms_ = arrival_ms;
+    }
+}
+
+void JitterBuffer::UpdateTargetDelay() {
+    int target = frame_duration_ms_ + (int)(jitter_ms_ * 3);
+    target_delay_ms_ = std::clamp(target, min_delay_ms_, max_delay_ms_);
+}
+
+bool JitterBuffer::HasRoomFor(uint32_t sequence) const {
+    if (!synced_ || count_.load(std::memory_order_relaxed) == 0) {
+        return true;
+    }
+    if (sequence == 0) {
+        sequence = highest_sequence_ + 1;
+    }
+    return (int32_t)(sequence - next_sequence_) < (int32_t)kWindowSize;
+}
+
+bool JitterBuffer::Put(const uint8_t* data, size_t size, uint32_t sequence, uint32_t arrival_ms) {
+    if (buffer_ == nullptr || size > max_packet_size_) {
+        return false;
+    }
+    if (sequence == 0) {
+        sequence = synced_ ? highest_sequence_ + 1 : 1;
+    }
+
+    UpdateJitter(sequence, arrival_ms);
+
+    if (!synced_) {
+        synced_ = true;
+        next_sequence_ = sequence;
+        highest_sequence_ = sequence;
+    }
+
+    int32_t offset = (int32_t)(sequence - next_sequence_);
+    if (offset < 0) {
+        if (offset > -(int32_t)kWindowSize * 4) {
+            late_packets_++;
+            return false;
+        }
+        // Far behind, the sender restarted its sequence numbers
+        ESP_LOGW(TAG, "Sequence restarted: %lu, expected: %lu", (unsigned long)sequence, (unsigned long)next_sequence_);
+        Reset();
+        return Put(data, size, sequence, arrival_ms);
+    }
+    if (offset >= (int32_t)kWindowSize) {
+        // Too far ahead, give up on the packets we are still waiting for
+        uint32_t new_next = sequence - kWindowSize + 1;
+        for (uint32_t s = next_sequence_; s != new_next; s++) {
+            auto index = s % kWindowSize;
+            if (slot_used_[index] && slot_sequences_[index] == s) {
+                slot_used_[index] = false;
+                count_.fetch_sub(1, std::memory_order_relaxed);
+            } else {
+                lost_packets_++;
+            }
+        }
+        next_sequence_ = new_next;
+        gap_pending_ = false;
+    }
+
+    auto index = sequence % kWindowSize;
+    if (slot_used_[index] && slot_sequences_[index] == sequence) {
+        return false; // Duplicate
+    }
+
+    if ((int32_t)(sequence - highest_sequence_) < 0) {
+        reordered_packets_++;
+    } else {
+        highest_sequence_ = sequence;
+    }
+
+    if (starved_ && sequence == next_sequence_) {
+        // The stream continued after we ran dry, the buffer was too shallow
+        underruns_++;
+        jitter_ms_ += frame_duration_ms_;
+    }
+    starved_ = false;
+
+    memcpy(buffer_ + index * max_packet_size_, data, size);
+    slot_sizes_[index] = size;
+    slot_sequences_[index] = sequence;
+    slot_used_[index] = true;
+    count_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+JitterBufferResult JitterBuffer::Get(std::vector<uint8_t>& packet, uint32_t now_ms, bool starving) {
+    auto count = count_.load(std::memory_order_relaxed);
+    if (count == 0) {
+        if (playing_) {
+            playing_ = false;
+            starved_ = true;
+        }
+        return kJitterBufferBuffering;
+    }
+
+    if (!playing_) {
+        UpdateTargetDelay();
+        int buffered_ms = (int)(highest_sequence_ - next_sequence_ + 1) * frame_duration_ms_;
+        bool drain = flushing_ || (starving && started_);
+        if (buffered_ms < target_delay_ms_ && !drain) {
+            return kJitterBufferBuffering;
+        }
+        playing_ = true;
+        started_ = true;
+    }
+
+    auto index = next_sequence_ % kWindowSize;
+    if (slot_used_[index] && slot_sequences_[index] == next_sequence_) {
+        auto data = buffer_ + index * max_packet_size_;
+        packet.assign(data, data + slot_sizes_[index]);
+        slot_used_[index] = false;
+        count_.fetch_sub(1, std::memory_order_relaxed);
+        next_sequence_++;
+        gap_pending_ = false;
+        return kJitterBufferPacket;
+    }
+
+    // A later packet is already here, hold the gap for a while in case this one was
+    // only reordered. The rest of a run of missing packets has waited just as long.
+    if (!gap_pending_) {
+        gap_pending_ = true;
+        gap_since_ms_ = now_ms;
+    }
+    if (!starving && !flushing_ && (int32_t)(now_ms - gap_since_ms_) < min_delay_ms_) {
+        return kJitterBufferBuffering;
+    }
+    next_sequence_++;
+    lost_packets_++;
+    return kJitterBufferLost;
+}
+
+const uint8_t* JitterBuffer::Peek(size_t& size) const {
+    auto index = next_sequence_ % kWindowSize;
+    if (!slot_used_[index] || slot_sequences_[index] != next_sequence_) {
+        size = 0;
+        return nullptr;
+    }
+    size = slot_sizes_[index];
+    return buffer_ + index * max_packet_size_;
+}
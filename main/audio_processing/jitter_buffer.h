@@ -0,0 +1,95 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <atomic>
+
+enum JitterBufferResult {
+    kJitterBufferBuffering, // Nothing to play yet, or waiting for a missing packet
+    kJitterBufferPacket,    // The next packet in sequence order
+    kJitterBufferLost       // The next packet is missing, conceal it
+};
+
+// Reorders incoming audio packets by sequence number and holds back playback until
+// enough audio is buffered to cover the measured network jitter. A missing packet is
+// waited for up to min_delay_ms before it is reported lost, unless the caller is
+// about to run out of audio.
+// Not thread safe, Put and Get are expected to run on the decoding task.
+class JitterBuffer {
+public:
+    JitterBuffer(int frame_duration_ms, int min_delay_ms, int max_delay_ms, size_t max_packet_size);
+    ~JitterBuffer();
+    JitterBuffer(const JitterBuffer&) = delete;
+    JitterBuffer& operator=(const JitterBuffer&) = delete;
+
+    // sequence == 0 means the packet directly follows the previous one
+    bool Put(const uint8_t* data, size_t size, uint32_t sequence, uint32_t arrival_ms);
+    // False while the packet is too far ahead of the playout position to be held,
+    // the caller should keep it until earlier packets have been played
+    bool HasRoomFor(uint32_t sequence) const;
+    // starving means the output is about to run dry, a missing packet is given up at once
+    // and a stream that already played is drained instead of buffered up again
+    JitterBufferResult Get(std::vector<uint8_t>& packet, uint32_t now_ms, bool starving = false);
+    // The packet Get would return next if it is already here, otherwise nullptr
+    const uint8_t* Peek(size_t& size) const;
+    // End of stream, Get hands out everything buffered without waiting for the target
+    // delay or for missing packets. Reset starts the next stream.
+    void Flush() { flushing_ = true; }
+    // Drop all packets and wait for a new stream, keeps the jitter estimate
+    void Reset();
+    // Downlink frame duration announced by the server, only change it while empty
+    void SetFrameDuration(int frame_duration_ms) { frame_duration_ms_ = frame_duration_ms; }
+
+    bool empty() const { return count_.load(std::memory_order_relaxed) == 0; }
+    inline int frame_duration_ms() const { return frame_duration_ms_; }
+    inline int target_delay_ms() const { return target_delay_ms_; }
+    inline int jitter_ms() const { return (int)jitter_ms_; }
+    inline uint32_t lost_packets() const { return lost_packets_; }
+    inline uint32_t late_packets() const { return late_packets_; }
+    inline uint32_t reordered_packets() const { return reordered_packets_; }
+    inline uint32_t underruns() const { return underruns_; }
+    void ResetStatistics();
+
+private:
+    static constexpr uint32_t kWindowSize = 32;
+
+    int frame_duration_ms_;
+    int min_delay_ms_;
+    int max_delay_ms_;
+    size_t max_packet_size_;
+    uint8_t* buffer_ = nullptr;
+    uint16_t slot_sizes_[kWindowSize];
+    uint32_t slot_sequences_[kWindowSize];
+    bool slot_used_[kWindowSize];
+    std::atomic<size_t> count_{0};
+
+    bool synced_ = false;
+    bool playing_ = false;
+    bool starved_ = false;
+    bool started_ = false;
+    bool flushing_ = false;
+    uint32_t next_sequence_ = 0;
+    uint32_t highest_sequence_ = 0;
+    // Set while next_sequence_ is missing and later packets are already here
+    bool gap_pending_ = false;
+    uint32_t gap_since_ms_ = 0;
+
+    bool has_last_arrival_ = false;
+    uint32_t last_arrival_sequence_ = 0;
+    uint32_t last_arrival_ms_ = 0;
+    float jitter_ms_ = 0;
+    int target_delay_ms_;
+
+    uint32_t lost_packets_ = 0;
+    uint32_t late_packets_ = 0;
+    uint32_t reordered_packets_ = 0;
+    uint32_t underruns_ = 0;
+
+    void UpdateJitter(uint32_t sequence, uint32_t arrival_ms);
+    void UpdateTargetDelay();
+    void ClearSlots();
+};
+
+#endif // JITTER_BUFFER_H
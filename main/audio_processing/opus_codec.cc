@@ -0,0 +1,200 @@
+#include "opus_codec.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#define TAG "OpusCodec"
+
+// Uplink bitrates for a clean, a lossy and a bad network, FEC takes part of the
+// budget so the lossy steps spend less on the primary frame
+#define OPUS_UPLINK_BITRATE_CLEAN 24000
+#define OPUS_UPLINK_BITRATE_LOSSY 20000
+#define OPUS_UPLINK_BITRATE_BAD 16000
+#define OPUS_UPLINK_FEC_MIN_LOSS 2
+#define OPUS_UPLINK_BAD_LOSS 10
+// IPv4, UDP and the 16 byte nonce header every MQTT UDP audio packet carries
+#define OPUS_UPLINK_PACKET_OVERHEAD 44
+
+OpusUplinkEncoder::OpusUplinkEncoder(int sample_rate, int channels, int duration_ms)
+    : sample_rate_(sample_rate), channels_(channels), duration_ms_(duration_ms) {
+    int error;
+    encoder_ = opus_encoder_create(sample_rate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (encoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio encoder, error code: %d", error);
+        return;
+    }
+    frame_size_ = sample_rate / 1000 * channels * duration_ms;
+    in_buffer_.reserve(frame_size_ * 2);
+    packet_.reserve(OPUS_CODEC_MAX_PACKET_SIZE);
+
+    SetDtx(true);
+    // Complexity 5 almost uses up all CPU of ESP32C3
+    SetComplexity(5);
+    AdaptToPacketLoss(0);
+}
+
+OpusUplinkEncoder::~OpusUplinkEncoder() {
+    if (encoder_ != nullptr) {
+        opus_encoder_destroy(encoder_);
+    }
+}
+
+void OpusUplinkEncoder::SetDtx(bool enable) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    opus_encoder_ctl(encoder_, OPUS_SET_DTX(enable ? 1 : 0));
+}
+
+void OpusUplinkEncoder::SetComplexity(int complexity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    opus_encoder_ctl(encoder_, OPUS_SET_COMPLEXITY(complexity));
+}
+
+void OpusUplinkEncoder::SetFrameDuration(int duration_ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (duration_ms == duration_ms_) {
+        return;
+    }
+    duration_ms_ = duration_ms;
+    frame_size_ = sample_rate_ / 1000 * channels_ * duration_ms;
+    in_buffer_.clear();
+    in_buffer_.reserve(frame_size_ * 2);
+    in_offset_ = 0;
+}
+
+void OpusUplinkEncoder::AdaptToPacketLoss(int loss_percent) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    bool fec = loss_percent >= OPUS_UPLINK_FEC_MIN_LOSS;
+    int bitrate = !fec ? OPUS_UPLINK_BITRATE_CLEAN
+        : loss_percent < OPUS_UPLINK_BAD_LOSS ? OPUS_UPLINK_BITRATE_LOSSY : OPUS_UPLINK_BITRATE_BAD;
+    if (fec == fec_ && bitrate == bitrate_) {
+        return;
+    }
+    fec_ = fec;
+    bitrate_ = bitrate;
+    opus_encoder_ctl(encoder_, OPUS_SET_INBAND_FEC(fec ? 1 : 0));
+    opus_encoder_ctl(encoder_, OPUS_SET_PACKET_LOSS_PERC(fec ? loss_percent : 0));
+    opus_encoder_ctl(encoder_, OPUS_SET_BITRATE(bitrate));
+    ESP_LOGI(TAG, "Uplink for %d%% loss: %d bps, FEC %s", loss_percent, bitrate, fec ? "on" : "off");
+}
+
+void OpusUplinkEncoder::Encode(std::vector<int16_t>&& pcm, std::function<void(const std::vector<uint8_t>& opus)> handler) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ == nullptr) {
+        return;
+    }
+
+    if (in_offset_ > 0 && in_buffer_.size() + pcm.size() > in_buffer_.capacity()) {
+        in_buffer_.erase(in_buffer_.begin(), in_buffer_.begin() + in_offset_);
+        in_offset_ = 0;
+    }
+    in_buffer_.insert(in_buffer_.end(), pcm.begin(), pcm.end());
+    while (in_buffer_.size() - in_offset_ >= (size_t)frame_size_) {
+        packet_.resize(OPUS_CODEC_MAX_PACKET_SIZE);
+        auto start_time = esp_timer_get_time();
+        auto ret = opus_encode(encoder_, in_buffer_.data() + in_offset_, frame_size_, packet_.data(), packet_.size());
+        session_encode_us_ += esp_timer_get_time() - start_time;
+        in_offset_ += frame_size_;
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Failed to encode audio, error code: %d", ret);
+            break;
+        }
+        session_packets_++;
+        session_bytes_ += ret;
+        if (handler != nullptr) {
+            packet_.resize(ret);
+            handler(packet_);
+        }
+    }
+    // Capture frames are usually whole Opus frames, then nothing is left to move
+    if (in_offset_ == in_buffer_.size()) {
+        in_buffer_.clear();
+        in_offset_ = 0;
+    }
+}
+
+void OpusUplinkEncoder::ResetState() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (encoder_ != nullptr) {
+        opus_encoder_ctl(encoder_, OPUS_RESET_STATE);
+    }
+    in_buffer_.clear();
+    in_offset_ = 0;
+}
+
+void OpusUplinkEncoder::LogSession() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (session_packets_ == 0) {
+        return;
+    }
+    // What the frame duration costs: encode time per second of audio and bytes on the wire
+    int audio_ms = session_packets_ * duration_ms_;
+    ESP_LOGI(TAG, "Uplink %d ms frames: %lu packets, %lu bytes/packet + %d header, %lu bytes/s, encode %lld us/frame, %.1f%% CPU",
+        duration_ms_, session_packets_, session_bytes_ / session_packets_, OPUS_UPLINK_PACKET_OVERHEAD,
+        (uint32_t)((session_bytes_ + session_packets_ * OPUS_UPLINK_PACKET_OVERHEAD) * 1000ull / audio_ms),
+        session_encode_us_ / session_packets_, session_encode_us_ / (audio_ms * 10.0f));
+    session_packets_ = 0;
+    session_bytes_ = 0;
+    session_encode_us_ = 0;
+}
+
+OpusDownlinkDecoder::OpusDownlinkDecoder(int sample_rate, int channels)
+    : sample_rate_(sample_rate), channels_(channels) {
+    int error;
+    decoder_ = opus_decoder_create(sample_rate, channels, &error);
+    if (decoder_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to create audio decoder, error code: %d", error);
+    }
+    // Until the first packet tells otherwise
+    last_frame_size_ = sample_rate / 1000 * 60;
+}
+
+OpusDownlinkDecoder::~OpusDownlinkDecoder() {
+    if (decoder_ != nullptr) {
+        opus_decoder_destroy(decoder_);
+    }
+}
+
+bool OpusDownlinkDecoder::Decode(const uint8_t* data, size_t size, std::vector<int16_t>& pcm) {
+    if (decoder_ == nullptr) {
+        return false;
+    }
+    int frame_size = opus_packet_get_nb_samples(data, size, sample_rate_);
+    if (frame_size <= 0) {
+        ESP_LOGE(TAG, "Invalid audio packet, error code: %d", frame_size);
+        return false;
+    }
+    pcm.resize(frame_size * channels_);
+    auto ret = opus_decode(decoder_, data, size, pcm.data(), frame_size, 0);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to decode audio, error code: %d", ret);
+        return false;
+    }
+    last_frame_size_ = frame_size;
+    return true;
+}
+
+bool OpusDownlinkDecoder::Recover(const uint8_t* next, size_t next_size, std::vector<int16_t>& pcm) {
+    if (decoder_ == nullptr) {
+        return false;
+    }
+    pcm.resize(last_frame_size_ * channels_);
+    // FEC only helps if the next packet carries LBRR data, otherwise conceal the frame
+    bool fec = next != nullptr && opus_packet_has_lbrr(next, next_size) == 1;
+    auto ret = opus_decode(decoder_, fec ? next : nullptr, fec ? next_size : 0, pcm.data(), last_frame_size_, fec ? 1 : 0);
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to recover audio, error code: %d", ret);
+        return false;
+    }
+    if (fec) {
+        recovered_frames_++;
+    } else {
+        concealed_frames_++;
+    }
+    return true;
+}
+
+void OpusDownlinkDecoder::ResetState() {
+    if (decoder_ != nullptr) {
+        opus_decoder_ctl(decoder_, OPUS_RESET_STATE);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef OPUS_CODEC_H
+#define OPUS_CODEC_H
+
+#include <opus.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <functional>
+
+#define OPUS_CODEC_MAX_PACKET_SIZE 1000
+
+// Uplink encoder on libopus directly, so in-band FEC, bitrate and the expected packet
+// loss can be tuned per session. Same buffering as OpusEncoderWrapper: Encode
+// collects samples and calls the handler once per complete frame.
+class OpusUplinkEncoder {
+public:
+    OpusUplinkEncoder(int sample_rate, int channels, int duration_ms);
+    ~OpusUplinkEncoder();
+    OpusUplinkEncoder(const OpusUplinkEncoder&) = delete;
+    OpusUplinkEncoder& operator=(const OpusUplinkEncoder&) = delete;
+
+    void SetDtx(bool enable);
+    void SetComplexity(int complexity);
+    // Takes effect from the next frame, the samples still buffered are dropped
+    void SetFrameDuration(int duration_ms);
+    // Picks FEC, bitrate and the loss hint for the measured packet loss
+    void AdaptToPacketLoss(int loss_percent);
+
+    // pcm is copied, the caller keeps its buffer. opus is a reused buffer that is only
+    // valid during the handler call, copy it to keep the packet.
+    void Encode(std::vector<int16_t>&& pcm, std::function<void(const std::vector<uint8_t>& opus)> handler);
+    void ResetState();
+    // Logs the packet count, payload size and encode time since the last call, then resets them
+    void LogSession();
+
+    inline int sample_rate() const { return sample_rate_; }
+    inline int duration_ms() const { return duration_ms_; }
+    inline int bitrate() const { return bitrate_; }
+    inline bool fec() const { return fec_; }
+
+private:
+    std::mutex mutex_;
+    OpusEncoder* encoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int duration_ms_;
+    int frame_size_;
+    int bitrate_ = 0;
+    bool fec_ = false;
+    std::vector<int16_t> in_buffer_;
+    // Samples before in_offset_ are encoded, they are only erased when the next Encode
+    // would not fit in the reserved buffer
+    size_t in_offset_ = 0;
+    std::vector<uint8_t> packet_;
+    uint32_t session_packets_ = 0;
+    uint32_t session_bytes_ = 0;
+    int64_t session_encode_us_ = 0;
+};
+
+// Downlink decoder on libopus directly, so a lost frame can be rebuilt from the FEC
+// data carried by the packet after it. Only used from the decode stream.
+class OpusDownlinkDecoder {
+public:
+    OpusDownlinkDecoder(int sample_rate, int channels);
+    ~OpusDownlinkDecoder();
+    OpusDownlinkDecoder(const OpusDownlinkDecoder&) = delete;
+    OpusDownlinkDecoder& operator=(const OpusDownlinkDecoder&) = delete;
+
+    bool Decode(const uint8_t* data, size_t size, std::vector<int16_t>& pcm);
+    // Rebuilds the frame before next from its LBRR data, or conceals it if next is null or has none
+    bool Recover(const uint8_t* next, size_t next_size, std::vector<int16_t>& pcm);
+    void ResetState();
+
+    inline int sample_rate() const { return sample_rate_; }
+    // Frames rebuilt with the help of the next packet
+    inline uint32_t recovered_frames() const { return recovered_frames_; }
+    inline uint32_t concealed_frames() const { return concealed_frames_; }
+
+private:
+    OpusDecoder* decoder_ = nullptr;
+    int sample_rate_;
+    int channels_;
+    int last_frame_size_;
+    uint32_t recovered_frames_ = 0;
+    uint32_t concealed_frames_ = 0;
+};
+
+#endif // OPUS_CODEC_H
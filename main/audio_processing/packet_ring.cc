@@ -0,0 +1,131 @@
+#include "packet_ring.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <cstring>
+
+#define TAG "PacketRing"
+
+static void* AllocateRingMemory(size_t size) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (ptr != nullptr) {
+        return ptr;
+    }
+#endif
+    return heap_caps_malloc(size, MALLOC_CAP_8BIT);
+}
+
+PacketRing::PacketRing(size_t capacity, size_t max_packet_size, size_t buffer_bytes)
+    : capacity_(capacity), max_packet_size_(max_packet_size), buffer_bytes_(buffer_bytes) {
+    if (buffer_bytes_ == 0) {
+        // One record more than capacity covers the bytes lost at the wrap point
+        buffer_bytes_ = (capacity_ + 1) * RecordSize(max_packet_size_);
+    }
+    buffer_bytes_ &= ~(size_t)3;
+    buffer_ = (uint8_t*)AllocateRingMemory(buffer_bytes_);
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %zu bytes for %zu packets", buffer_bytes_, capacity_);
+        capacity_ = 0;
+    }
+}
+
+PacketRing::~PacketRing() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+size_t PacketRing::WrapSkip(size_t position) const {
+    size_t offset = position % buffer_bytes_;
+    size_t remaining = buffer_bytes_ - offset;
+    if (remaining < sizeof(RecordHeader)) {
+        return remaining;
+    }
+    auto header = (const RecordHeader*)(buffer_ + offset);
+    return header->size == kWrapMarker ? remaining : 0;
+}
+
+bool PacketRing::Push(const uint8_t* data, size_t size, uint32_t sequence, uint32_t timestamp) {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto tail = tail_.load(std::memory_order_acquire);
+    auto head_bytes = head_bytes_.load(std::memory_order_relaxed);
+    auto tail_bytes = tail_bytes_.load(std::memory_order_acquire);
+
+    size_t record = RecordSize(size);
+    size_t offset = head_bytes % buffer_bytes_;
+    size_t remaining = buffer_bytes_ - offset;
+    size_t skip = remaining < record ? remaining : 0;
+    if (size > max_packet_size_ || head - tail >= capacity_ ||
+        head_bytes - tail_bytes + skip + record > buffer_bytes_) {
+        dropped_packets_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (skip > 0) {
+        if (remaining >= sizeof(RecordHeader)) {
+            ((RecordHeader*)(buffer_ + offset))->size = kWrapMarker;
+        }
+        offset = 0;
+    }
+    auto header = (RecordHeader*)(buffer_ + offset);
+    *header = { (uint16_t)size, sequence, timestamp };
+    memcpy(header + 1, data, size);
+    head_bytes_.store(head_bytes + skip + record, std::memory_order_release);
+    head_.store(head + 1, std::memory_order_release);
+
+    auto occupancy = head + 1 - tail;
+    if (occupancy > high_water_mark_.load(std::memory_order_relaxed)) {
+        high_water_mark_.store(occupancy, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+const uint8_t* PacketRing::Front(size_t& size, uint32_t* sequence, uint32_t* timestamp) const {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+        size = 0;
+        return nullptr;
+    }
+    auto position = tail_bytes_.load(std::memory_order_relaxed);
+    position += WrapSkip(position);
+    auto header = (const RecordHeader*)(buffer_ + position % buffer_bytes_);
+    size = header->size;
+    if (sequence != nullptr) {
+        *sequence = header->sequence;
+    }
+    if (timestamp != nullptr) {
+        *timestamp = header->timestamp;
+    }
+    return (const uint8_t*)(header + 1);
+}
+
+void PacketRing::Pop() {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+        return;
+    }
+    auto position = tail_bytes_.load(std::memory_order_relaxed);
+    position += WrapSkip(position);
+    auto header = (const RecordHeader*)(buffer_ + position % buffer_bytes_);
+    tail_bytes_.store(position + RecordSize(header->size), std::memory_order_release);
+    tail_.store(tail + 1, std::memory_order_release);
+}
+
+void PacketRing::Clear() {
+    // Record by record, the byte position has to stay in step with the packet count
+    auto head = head_.load(std::memory_order_acquire);
+    while (tail_.load(std::memory_order_relaxed) != head) {
+        Pop();
+    }
+}
+
+size_t PacketRing::size() const {
+    auto tail = tail_.load(std::memory_order_acquire);
+    return head_.load(std::memory_order_acquire) - tail;
+}
+
+void PacketRing::ResetStatistics() {
+    high_water_mark_.store(size(), std::memory_order_relaxed);
+    dropped_packets_.store(0, std::memory_order_relaxed);
+}
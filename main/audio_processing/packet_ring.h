@@ -0,0 +1,70 @@
+#ifndef PACKET_RING_H
+#define PACKET_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+// Fixed capacity single-producer / single-consumer ring of variable sized packets.
+// Packets are stored back to back in one byte buffer, each one takes its own size plus
+// a small header, so the buffer can be sized for the usual packet instead of the largest.
+// The buffer is allocated once (in PSRAM when available), Push and Pop never allocate
+// and never take a lock. Push must only be called from one task and Front / Pop / Clear
+// from one (other) task.
+class PacketRing {
+public:
+    // buffer_bytes == 0 makes room for capacity packets of max_packet_size
+    PacketRing(size_t capacity, size_t max_packet_size, size_t buffer_bytes = 0);
+    ~PacketRing();
+    PacketRing(const PacketRing&) = delete;
+    PacketRing& operator=(const PacketRing&) = delete;
+
+    // Producer side, returns false if the ring is full, out of buffer space or the
+    // packet is too large.
+    // sequence and timestamp are stored alongside the packet for the consumer.
+    bool Push(const uint8_t* data, size_t size, uint32_t sequence = 0, uint32_t timestamp = 0);
+
+    // Consumer side, the returned pointer stays valid until the next Pop or Clear
+    const uint8_t* Front(size_t& size, uint32_t* sequence = nullptr, uint32_t* timestamp = nullptr) const;
+    void Pop();
+    void Clear();
+
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+    inline size_t capacity() const { return capacity_; }
+    inline size_t max_packet_size() const { return max_packet_size_; }
+    inline size_t buffer_bytes() const { return buffer_bytes_; }
+    inline size_t high_water_mark() const { return high_water_mark_.load(std::memory_order_relaxed); }
+    inline size_t dropped_packets() const { return dropped_packets_.load(std::memory_order_relaxed); }
+    void ResetStatistics();
+
+private:
+    // Precedes every packet, records start 4-byte aligned
+    struct RecordHeader {
+        uint16_t size;
+        uint32_t sequence;
+        uint32_t timestamp;
+    };
+    // Header size marking that the next record starts at the beginning of the buffer
+    static constexpr uint16_t kWrapMarker = 0xFFFF;
+
+    size_t capacity_;
+    size_t max_packet_size_;
+    size_t buffer_bytes_;
+    uint8_t* buffer_ = nullptr;
+
+    // Monotonic packet counters
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+    // Monotonic byte counters, the offset in buffer_ is counter % buffer_bytes_
+    std::atomic<size_t> head_bytes_{0};
+    std::atomic<size_t> tail_bytes_{0};
+    std::atomic<size_t> high_water_mark_{0};
+    std::atomic<size_t> dropped_packets_{0};
+
+    static size_t RecordSize(size_t size) { return (sizeof(RecordHeader) + size + 3) & ~(size_t)3; }
+    // Bytes skipped at the end of the buffer before the record at position
+    size_t WrapSkip(size_t position) const;
+};
+
+#endif // PACKET_RING_H
@@ -0,0 +1,90 @@
+#include "playback_ring.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <cstring>
+
+#define TAG "PlaybackRing"
+
+static void* AllocateRingMemory(size_t size) {
+#if CONFIG_IDF_TARGET_ESP32S3
+    void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (ptr != nullptr) {
+        return ptr;
+    }
+#endif
+    return heap_caps_malloc(size, MALLOC_CAP_8BIT);
+}
+
+PlaybackRing::~PlaybackRing() {
+    if (buffer_ != nullptr) {
+        heap_caps_free(buffer_);
+    }
+}
+
+bool PlaybackRing::Initialize(size_t capacity_samples) {
+    buffer_ = (int16_t*)AllocateRingMemory(capacity_samples * sizeof(int16_t));
+    if (buffer_ == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %zu samples", capacity_samples);
+        return false;
+    }
+    capacity_ = capacity_samples;
+    return true;
+}
+
+size_t PlaybackRing::Write(const int16_t* data, size_t samples) {
+    auto head = head_.load(std::memory_order_relaxed);
+    auto tail = tail_.load(std::memory_order_acquire);
+    // Cleared samples are free, the reader skips them like Read does. A read that
+    // started before the Clear may still see a few of them overwritten, they were
+    // going to be dropped anyway.
+    auto clear_to = clear_to_.load(std::memory_order_acquire);
+    if ((ptrdiff_t)(clear_to - tail) > 0) {
+        tail = clear_to;
+    }
+    samples = std::min(samples, capacity_ - (head - tail));
+
+    auto index = head % capacity_;
+    auto first = std::min(samples, capacity_ - index);
+    memcpy(buffer_ + index, data, first * sizeof(int16_t));
+    memcpy(buffer_, data + first, (samples - first) * sizeof(int16_t));
+    head_.store(head + samples, std::memory_order_release);
+    return samples;
+}
+
+void PlaybackRing::Clear() {
+    auto head = head_.load(std::memory_order_acquire);
+    auto clear_to = clear_to_.load(std::memory_order_relaxed);
+    // Keep the furthest point if two tasks clear at once
+    while ((ptrdiff_t)(head - clear_to) > 0
+        && !clear_to_.compare_exchange_weak(clear_to, head, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+size_t PlaybackRing::Read(int16_t* out, size_t samples) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    auto head = head_.load(std::memory_order_acquire);
+    auto clear_to = clear_to_.load(std::memory_order_acquire);
+    if ((ptrdiff_t)(clear_to - tail) > 0) {
+        tail = clear_to;
+    }
+    samples = std::min(samples, head - tail);
+
+    auto index = tail % capacity_;
+    auto first = std::min(samples, capacity_ - index);
+    memcpy(out, buffer_ + index, first * sizeof(int16_t));
+    memcpy(out + first, buffer_, (samples - first) * sizeof(int16_t));
+    tail_.store(tail + samples, std::memory_order_release);
+    return samples;
+}
+
+size_t PlaybackRing::size() const {
+    auto tail = tail_.load(std::memory_order_acquire);
+    auto clear_to = clear_to_.load(std::memory_order_acquire);
+    auto head = head_.load(std::memory_order_acquire);
+    if ((ptrdiff_t)(clear_to - tail) > 0) {
+        tail = clear_to;
+    }
+    return head - tail;
+}
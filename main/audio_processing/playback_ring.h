@@ -0,0 +1,45 @@
+#ifndef PLAYBACK_RING_H
+#define PLAYBACK_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+// Single-producer / single-consumer PCM FIFO between the decoder and the playback
+// task. Allocated once (in PSRAM when available), Write and Read never allocate and
+// never take a lock. Clear may be called from any task, it discards what was written
+// before the call and the reader skips it on its next Read.
+class PlaybackRing {
+public:
+    PlaybackRing() = default;
+    ~PlaybackRing();
+    PlaybackRing(const PlaybackRing&) = delete;
+    PlaybackRing& operator=(const PlaybackRing&) = delete;
+
+    bool Initialize(size_t capacity_samples);
+
+    // Producer side, returns the number of samples stored
+    size_t Write(const int16_t* data, size_t samples);
+    // Consumer side, returns the number of samples copied to out
+    size_t Read(int16_t* out, size_t samples);
+    void Clear();
+
+    size_t size() const;
+    inline size_t capacity() const { return capacity_; }
+    inline uint32_t underruns() const { return underruns_.load(std::memory_order_relaxed); }
+    // Called by the consumer when it ran dry while more audio was still on its way
+    inline void CountUnderrun() { underruns_.fetch_add(1, std::memory_order_relaxed); }
+
+private:
+    int16_t* buffer_ = nullptr;
+    size_t capacity_ = 0;
+
+    // Monotonic sample counters, the index is counter % capacity_
+    std::atomic<size_t> head_{0};
+    std::atomic<size_t> tail_{0};
+    // Head at the last Clear, the reader moves tail up to it
+    std::atomic<size_t> clear_to_{0};
+    std::atomic<uint32_t> underruns_{0};
+};
+
+#endif // PLAYBACK_RING_H
@@ -0,0 +1,249 @@
+#include "polyphase_resampler.h"
+
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#ifdef ESP_PLATFORM
+#include <sdkconfig.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define TAG "PolyphaseResampler"
+
+// Kaiser window for about 70 dB of stop band rejection
+#define KAISER_BETA 7.0
+#define STOPBAND_DB 70.0
+// The pass band ends at this share of the lower Nyquist frequency, the stop band starts
+// at the lower Nyquist frequency
+#define PASSBAND_EDGE 0.8
+#define HISTORY_SAMPLES (taps_ - 1)
+// Aligned copies take 8 * (taps + 8) coefficients per phase, only worth it for small L
+#define ALIGNED_MAX_PHASES 16
+#define ALIGNED_TAPS (taps_ + 8)
+
+static double BesselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static int16_t* AllocateSamples(size_t samples) {
+    // Internal RAM, the filter reads every sample taps_ times
+    auto ptr = (int16_t*)heap_caps_aligned_alloc(16, samples * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (ptr == nullptr) {
+        ptr = (int16_t*)heap_caps_aligned_alloc(16, samples * sizeof(int16_t), MALLOC_CAP_8BIT);
+    }
+    return ptr;
+}
+
+PolyphaseResampler::~PolyphaseResampler() {
+    FreeBuffers();
+}
+
+void PolyphaseResampler::FreeBuffers() {
+    if (coefficients_ != nullptr) {
+        heap_caps_free(coefficients_);
+        coefficients_ = nullptr;
+    }
+    if (aligned_coefficients_ != nullptr) {
+        heap_caps_free(aligned_coefficients_);
+        aligned_coefficients_ = nullptr;
+    }
+    if (work_ != nullptr) {
+        heap_caps_free(work_);
+        work_ = nullptr;
+    }
+    work_capacity_ = 0;
+}
+
+bool PolyphaseResampler::Configure(int input_sample_rate, int output_sample_rate) {
+    FreeBuffers();
+    input_sample_rate_ = input_sample_rate;
+    output_sample_rate_ = output_sample_rate;
+    int gcd = std::gcd(input_sample_rate, output_sample_rate);
+    up_ = output_sample_rate / gcd;
+    down_ = input_sample_rate / gcd;
+
+    // Kaiser's estimate of the length for the transition band, in input samples
+    double bandwidth = std::min(1.0, (double)up_ / down_);
+    double transition = M_PI * (1.0 - PASSBAND_EDGE) * bandwidth;
+    int taps = (int)std::ceil((STOPBAND_DB - 8.0) / (2.285 * transition));
+    taps_ = (taps + 7) / 8 * 8;
+
+    coefficients_ = AllocateSamples(up_ * taps_);
+    if (coefficients_ == nullptr || !ReserveWork(1024)) {
+        ESP_LOGE(TAG, "Failed to allocate the filter for %d -> %d", input_sample_rate, output_sample_rate);
+        FreeBuffers();
+        return false;
+    }
+
+    // Low pass in the middle of the transition band, in input sample units
+    double cutoff = (1.0 + PASSBAND_EDGE) / 2 * bandwidth;
+    double half = taps_ / 2.0;
+    double window_norm = BesselI0(KAISER_BETA);
+    std::vector<double> taps_buffer(taps_);
+    for (int phase = 0; phase < up_; phase++) {
+        double sum = 0;
+        for (int tap = 0; tap < taps_; tap++) {
+            // Distance from the output instant to this input sample
+            double distance = (tap - (half - 1)) - (double)phase / up_;
+            double x = M_PI * cutoff * distance;
+            double sinc = x == 0 ? 1.0 : std::sin(x) / x;
+            double r = distance / half;
+            double window = std::fabs(r) >= 1.0 ? 0.0 : BesselI0(KAISER_BETA * std::sqrt(1.0 - r * r)) / window_norm;
+            taps_buffer[tap] = sinc * window;
+            sum += taps_buffer[tap];
+        }
+        // Unity gain at DC for every phase, the newest sample goes last
+        for (int tap = 0; tap < taps_; tap++) {
+            coefficients_[phase * taps_ + tap] = (int16_t)std::lround(taps_buffer[tap] / sum * 32767.0);
+        }
+    }
+
+#if CONFIG_IDF_TARGET_ESP32S3
+    if (up_ <= ALIGNED_MAX_PHASES) {
+        aligned_coefficients_ = AllocateSamples(up_ * 8 * ALIGNED_TAPS);
+        if (aligned_coefficients_ != nullptr) {
+            memset(aligned_coefficients_, 0, up_ * 8 * ALIGNED_TAPS * sizeof(int16_t));
+            for (int phase = 0; phase < up_; phase++) {
+                for (int offset = 0; offset < 8; offset++) {
+                    memcpy(aligned_coefficients_ + (phase * 8 + offset) * ALIGNED_TAPS + offset,
+                        coefficients_ + phase * taps_, taps_ * sizeof(int16_t));
+                }
+            }
+        }
+    }
+#endif
+
+    Reset();
+    ESP_LOGI(TAG, "Configured %d -> %d Hz, L=%d M=%d, %d taps", input_sample_rate, output_sample_rate, up_, down_, taps_);
+    return true;
+}
+
+void PolyphaseResampler::Reset() {
+    if (work_ != nullptr) {
+        memset(work_, 0, HISTORY_SAMPLES * sizeof(int16_t));
+    }
+    position_ = 0;
+    phase_ = 0;
+}
+
+bool PolyphaseResampler::ReserveWork(size_t samples) {
+    // History, input and 8 samples of padding for the aligned block loads
+    size_t needed = HISTORY_SAMPLES + samples + 8;
+    if (needed <= work_capacity_) {
+        return true;
+    }
+    auto work = AllocateSamples(needed);
+    if (work == nullptr) {
+        return false;
+    }
+    memset(work, 0, needed * sizeof(int16_t));
+    if (work_ != nullptr) {
+        memcpy(work, work_, HISTORY_SAMPLES * sizeof(int16_t));
+        heap_caps_free(work_);
+    }
+    work_ = work;
+    work_capacity_ = needed;
+    return true;
+}
+
+size_t PolyphaseResampler::GetOutputSamples(size_t input_samples) const {
+    return (input_samples * up_ + down_ - 1) / down_ + 1;
+}
+
+#if CONFIG_IDF_TARGET_ESP32S3
+// Both pointers 16-byte aligned, blocks of 8 taps accumulated in the 40-bit ACCX
+static inline int32_t DotPie(const int16_t* samples, const int16_t* coefficients, int blocks) {
+    int32_t result;
+    int32_t shift = 0;
+    asm volatile("ee.zero.accx\n");
+    for (int i = 0; i < blocks; i++) {
+        asm volatile(
+            "ee.vld.128.ip q0, %0, 16\n"
+            "ee.vld.128.ip q1, %1, 16\n"
+            "ee.vmulas.s16.accx q0, q1\n"
+            : "+r"(samples), "+r"(coefficients)
+            :
+            : "memory");
+    }
+    asm volatile("ee.srs.accx %0, %1, 0\n" : "=r"(result) : "r"(shift));
+    return result;
+}
+#endif
+
+// window points at the oldest of the taps_ input samples, index is its
+// position in work_ and only matters for the aligned PIE path
+int32_t PolyphaseResampler::Dot(const int16_t* window, int phase, size_t index) const {
+    const int16_t* h = coefficients_ + phase * taps_;
+#if CONFIG_IDF_TARGET_ESP32S3
+    if (aligned_coefficients_ != nullptr) {
+        size_t offset = index & 7;
+        return DotPie(work_ + index - offset, aligned_coefficients_ + (phase * 8 + offset) * ALIGNED_TAPS,
+            ALIGNED_TAPS / 8);
+    }
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (int tap = 0; tap < taps_; tap += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(window + tap));
+        __m128i c = _mm_loadu_si128((const __m128i*)(h + tap));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(x, c));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+#elif defined(__ARM_NEON)
+    int32x4_t acc = vdupq_n_s32(0);
+    for (int tap = 0; tap < taps_; tap += 8) {
+        int16x8_t x = vld1q_s16(window + tap);
+        int16x8_t c = vld1q_s16(h + tap);
+        acc = vmlal_s16(acc, vget_low_s16(x), vget_low_s16(c));
+        acc = vmlal_s16(acc, vget_high_s16(x), vget_high_s16(c));
+    }
+    return vaddvq_s32(acc);
+#endif
+#if !defined(__SSE2__) && !defined(__ARM_NEON)
+    int32_t acc = 0;
+    for (int tap = 0; tap < taps_; tap++) {
+        acc += (int32_t)window[tap] * h[tap];
+    }
+    return acc;
+#endif
+}
+
+size_t PolyphaseResampler::Process(const int16_t* in, size_t samples, int16_t* out) {
+    if (coefficients_ == nullptr || !ReserveWork(samples)) {
+        return 0;
+    }
+    // Copy first, so out may alias in
+    memcpy(work_ + HISTORY_SAMPLES, in, samples * sizeof(int16_t));
+
+    size_t count = 0;
+    while (position_ < samples) {
+        int32_t acc = Dot(work_ + position_, phase_, position_);
+        acc = (acc + (1 << 14)) >> 15;
+        out[count++] = (int16_t)std::clamp<int32_t>(acc, INT16_MIN, INT16_MAX);
+
+        phase_ += down_;
+        position_ += phase_ / up_;
+        phase_ %= up_;
+    }
+    position_ -= samples;
+
+    // The last samples become the history of the next call
+    memmove(work_, work_ + samples, HISTORY_SAMPLES * sizeof(int16_t));
+    return count;
+}
@@ -0,0 +1,59 @@
+#ifndef POLYPHASE_RESAMPLER_H
+#define POLYPHASE_RESAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Fixed-point polyphase resampler for mono 16-bit PCM, L/M rational ratios such as
+// 16 <-> 24 <-> 48 kHz and 44.1 kHz. Kaiser windowed sinc in Q15, flat to 80% of the
+// lower Nyquist frequency and about 70 dB down from the lower Nyquist frequency on, so
+// decimation does not alias. The filter length grows with the decimation ratio. The
+// filter state carries over between calls so frames can be any size. Buffers are allocated in
+// Configure and grown once to the largest frame seen, Process never allocates after that.
+// Process may write its output over its input (out == in).
+// On the ESP32-S3 the small ratios use PIE with per-alignment coefficient copies,
+// the host build uses SSE2 or NEON, everything else a plain multiply-accumulate loop.
+class PolyphaseResampler {
+public:
+    PolyphaseResampler() = default;
+    ~PolyphaseResampler();
+    PolyphaseResampler(const PolyphaseResampler&) = delete;
+    PolyphaseResampler& operator=(const PolyphaseResampler&) = delete;
+
+    bool Configure(int input_sample_rate, int output_sample_rate);
+    void Reset();
+
+    // Returns the number of samples written to out
+    size_t Process(const int16_t* in, size_t samples, int16_t* out);
+    // Upper bound of the output of Process for this many input samples
+    size_t GetOutputSamples(size_t input_samples) const;
+
+    inline int input_sample_rate() const { return input_sample_rate_; }
+    inline int output_sample_rate() const { return output_sample_rate_; }
+    inline int taps_per_phase() const { return taps_; }
+
+private:
+    int input_sample_rate_ = 0;
+    int output_sample_rate_ = 0;
+    int up_ = 1;    // L
+    int down_ = 1;  // M
+    // Multiple of 8, so the vector paths need no tail loop
+    int taps_ = 0;
+
+    // coefficients_[phase * taps_ + tap]
+    int16_t* coefficients_ = nullptr;
+    // Copies of every phase shifted by 0..7 taps for aligned 128-bit loads, may be null
+    int16_t* aligned_coefficients_ = nullptr;
+
+    // taps_ - 1 samples of history followed by the current input
+    int16_t* work_ = nullptr;
+    size_t work_capacity_ = 0;
+    size_t position_ = 0;
+    int phase_ = 0;
+
+    void FreeBuffers();
+    bool ReserveWork(size_t samples);
+    int32_t Dot(const int16_t* window, int phase, size_t index) const;
+};
+
+#endif // POLYPHASE_RESAMPLER_H
@@ -0,0 +1,79 @@
+#include "uplink_gate.h"
+
+#include <esp_log.h>
+#include <cmath>
+
+#define TAG "UplinkGate"
+
+UplinkGate::UplinkGate(const UplinkGateConfig& config) : config_(config) {
+    // Mean square of a full scale signal at the threshold level
+    double amplitude = 32768.0 * std::pow(10.0, config_.threshold_dbfs / 20.0);
+    energy_threshold_ = (int64_t)(amplitude * amplitude);
+}
+
+void UplinkGate::Reset() {
+    packets_sent_.store(0, std::memory_order_relaxed);
+    packets_saved_.store(0, std::memory_order_relaxed);
+    bytes_sent_.store(0, std::memory_order_relaxed);
+    bytes_saved_.store(0, std::memory_order_relaxed);
+    restart_.store(true, std::memory_order_release);
+}
+
+void UplinkGate::Analyze(const int16_t* pcm, size_t samples) {
+    if (samples == 0) {
+        return;
+    }
+    if (restart_.exchange(false, std::memory_order_acquire)) {
+        silence_ms_ = 0;
+        closed_ms_ = 0;
+        open_ = true;
+    }
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < samples; i++) {
+        sum += (int32_t)pcm[i] * pcm[i];
+    }
+    int frame_ms = (int)(samples * 1000 / config_.sample_rate);
+
+    if (sum / (int64_t)samples >= energy_threshold_) {
+        silence_ms_ = 0;
+        open_ = true;
+        return;
+    }
+    silence_ms_ += frame_ms;
+    if (open_ && silence_ms_ > config_.hangover_ms) {
+        open_ = false;
+        // The first packet of silence goes out, it marks the start of the pause
+        closed_ms_ = config_.keepalive_ms;
+    }
+}
+
+bool UplinkGate::Accept(size_t packet_bytes, int duration_ms) {
+    bool send = open_;
+    if (!open_) {
+        closed_ms_ += duration_ms;
+        if (closed_ms_ >= config_.keepalive_ms) {
+            closed_ms_ = 0;
+            send = true;
+        }
+    }
+
+    if (send) {
+        packets_sent_.fetch_add(1, std::memory_order_relaxed);
+        bytes_sent_.fetch_add(packet_bytes, std::memory_order_relaxed);
+    } else {
+        packets_saved_.fetch_add(1, std::memory_order_relaxed);
+        bytes_saved_.fetch_add(packet_bytes, std::memory_order_relaxed);
+    }
+    return send;
+}
+
+void UplinkGate::LogSession() const {
+    auto sent = packets_sent_.load(std::memory_order_relaxed);
+    auto saved = packets_saved_.load(std::memory_order_relaxed);
+    if (sent + saved == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "Session: sent %lu packets %lu bytes, suppressed %lu packets %lu bytes (%lu%%)",
+        sent, bytes_sent(), saved, bytes_saved(), saved * 100 / (sent + saved));
+}
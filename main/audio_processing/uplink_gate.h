@@ -0,0 +1,53 @@
+#ifndef UPLINK_GATE_H
+#define UPLINK_GATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+struct UplinkGateConfig {
+    int sample_rate = 16000;
+    // Frames quieter than this are silence
+    int threshold_dbfs = -50;
+    // Silence after speech that is still sent, so word endings are not cut and the
+    // server's VAD sees the whole end-of-turn silence
+    int hangover_ms = 1000;
+    // While closed one packet is let through this often, with DTX on it carries the
+    // comfort noise update and tells the server the stream is alive
+    int keepalive_ms = 400;
+};
+
+// Energy gate for the uplink when there is no AFE VAD. Analyze sees every captured
+// frame, Accept every encoded packet, both from the encode stream. Packets of silence
+// are dropped and counted, the statistics may be read from any task.
+class UplinkGate {
+public:
+    explicit UplinkGate(const UplinkGateConfig& config = UplinkGateConfig());
+
+    // Starts a new session, the gate opens on the first frame
+    void Reset();
+    void Analyze(const int16_t* pcm, size_t samples);
+    // duration_ms is the audio in the encoded packet, it need not match the captured
+    // frames. Returns false if the packet should not be sent
+    bool Accept(size_t packet_bytes, int duration_ms);
+    // Logs the packets and bytes sent and saved since Reset
+    void LogSession() const;
+
+    inline uint32_t bytes_sent() const { return bytes_sent_.load(std::memory_order_relaxed); }
+    inline uint32_t bytes_saved() const { return bytes_saved_.load(std::memory_order_relaxed); }
+
+private:
+    UplinkGateConfig config_;
+    int64_t energy_threshold_;
+    std::atomic<bool> restart_{true};
+    int silence_ms_ = 0;
+    int closed_ms_ = 0;
+    bool open_ = true;
+
+    std::atomic<uint32_t> packets_sent_{0};
+    std::atomic<uint32_t> packets_saved_{0};
+    std::atomic<uint32_t> bytes_sent_{0};
+    std::atomic<uint32_t> bytes_saved_{0};
+};
+
+#endif // UPLINK_GATE_H
@@ -6,55 +6,77 @@
 #include <freertos/event_groups.h>
 
 #include <esp_afe_sr_models.h>
-#include <esp_nsn_models.h>
 
-#include <list>
 #include <string>
 #include <vector>
 #include <functional>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 
+#include "audio_front_end.h"
+#include "chunk_ring.h"
+#include "packet_ring.h"
 
+// Longest pre-roll sent to the server before the wake word
+#define WAKE_WORD_PRE_ROLL_MAX_MS 2000
+#ifndef CONFIG_WAKE_WORD_PRE_ROLL_MS
+#define CONFIG_WAKE_WORD_PRE_ROLL_MS WAKE_WORD_PRE_ROLL_MAX_MS
+#endif
+// The pre-roll is kept Opus encoded all the time, in packets of this size at most
+#define WAKE_WORD_OPUS_MAX_PACKET_SIZE 1024
+// PCM frames waiting for the pre-roll encoder
+#define WAKE_WORD_PCM_QUEUE_CAPACITY 4
+
+// Watches the shared front end results for the wake word and VAD changes
 class WakeWordDetect {
 public:
     WakeWordDetect();
     ~WakeWordDetect();
 
-    void Initialize(int channels, bool reference);
-    void Feed(const std::vector<int16_t>& data);
+    void Initialize(AudioFrontEnd& front_end);
     void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback);
     void OnVadStateChange(std::function<void(bool speaking)> callback);
     void StartDetection();
     void StopDetection();
     bool IsDetectionRunning();
+    // Takes the already encoded pre-roll, call while detection is stopped
     void EncodeWakeWordData();
+    // Copies the next pre-roll packet into opus, false after the last one
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
 
 private:
-    esp_afe_sr_data_t* afe_detection_data_ = nullptr;
-    char* wakenet_model_ = NULL;
-    std::vector<std::string> wake_words_;
-    std::vector<int16_t> input_buffer_;
+    const std::vector<std::string>* wake_words_ = nullptr;
     EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
     bool is_speaking_ = false;
-    int channels_;
-    bool reference_;
     std::string last_detected_wake_word_;
 
     TaskHandle_t wake_word_encode_task_ = nullptr;
     StaticTask_t wake_word_encode_task_buffer_;
     StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::list<std::vector<int16_t>> wake_word_pcm_;
-    std::list<std::vector<uint8_t>> wake_word_opus_;
+    // Fetch task -> encode task, one Opus frame of PCM per packet
+    ChunkRing pcm_framer_;
+    PacketRing pcm_frames_;
+    std::atomic<uint32_t> frames_queued_{0};
+    uint32_t frames_encoded_ = 0;
+    std::atomic<bool> reset_encoder_{false};
+    std::vector<int16_t> wake_word_pcm_;
+    // Rolling window of the encoded pre-roll, guarded by wake_word_mutex_
+    PacketRing wake_word_packets_;
+    // The pre-roll taken out of the window for sending, back to back in one buffer
+    // with the end offset of every packet. Both keep their capacity between wake ups.
+    std::vector<uint8_t> wake_word_opus_;
+    std::vector<size_t> wake_word_opus_ends_;
+    size_t wake_word_opus_next_ = 0;
+    bool wake_word_opus_ready_ = false;
     std::mutex wake_word_mutex_;
     std::condition_variable wake_word_cv_;
 
-    void StoreWakeWordData(uint16_t* data, size_t size);
-    void AudioDetectionTask();
+    void Process(const afe_fetch_result_t* result);
+    void EncodeTask();
 };
 
 #endif
@@ -1,67 +1,191 @@
 #include "background_task.h"
 
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstdio>
 
 #define TAG "BackgroundTask"
 
-BackgroundTask::BackgroundTask(uint32_t stack_size) {
+BackgroundTask::BackgroundTask(uint32_t stack_size, std::initializer_list<BaseType_t> cores, const char* name)
+    : workers_(cores.size()), stats_(name) {
+    streams_.reserve(BACKGROUND_TASK_MAX_STREAMS);
+    for (int i = 0; i < BACKGROUND_TASK_MAX_STREAMS; i++) {
+        streams_.emplace_back(BACKGROUND_TASK_QUEUE_SIZE);
+    }
+    size_t index = 0;
+    for (auto core : cores) {
+        auto& worker = workers_[index];
+        worker.owner = this;
+        worker.index = index;
+        int suffix = snprintf(nullptr, 0, "_%u", (unsigned)index);
+        snprintf(worker.name, sizeof(worker.name), "%.*s_%u", (int)sizeof(worker.name) - 1 - suffix, name,
+            (unsigned)index);
+        index++;
+        auto entry = [](void* arg) {
+            Worker* worker = (Worker*)arg;
+            worker->owner->BackgroundTaskLoop(*worker);
+        };
 #if CONFIG_IDF_TARGET_ESP32S3
-    task_stack_ = (StackType_t*)heap_caps_malloc(stack_size, MALLOC_CAP_SPIRAM);
-    background_task_handle_ = xTaskCreateStatic([](void* arg) {
-        BackgroundTask* task = (BackgroundTask*)arg;
-        task->BackgroundTaskLoop();
-    }, "background_task", stack_size, this, 1, task_stack_, &task_buffer_);
-#else
-    xTaskCreate([](void* arg) {
-        BackgroundTask* task = (BackgroundTask*)arg;
-        task->BackgroundTaskLoop();
-    }, "background_task", stack_size, this, 1, &background_task_handle_);
+        worker.task_stack = (StackType_t*)heap_caps_malloc(stack_size, MALLOC_CAP_SPIRAM);
+        if (worker.task_stack != nullptr) {
+            worker.handle = xTaskCreateStaticPinnedToCore(entry, worker.name, stack_size, &worker, 1,
+                worker.task_stack, &worker.task_buffer, core);
+            continue;
+        }
+        ESP_LOGW(TAG, "No PSRAM for the %lu byte stack of %s, using internal RAM", stack_size, worker.name);
 #endif
+        if (xTaskCreatePinnedToCore(entry, worker.name, stack_size, &worker, 1, &worker.handle, core) != pdPASS) {
+            worker.handle = nullptr;
+            ESP_LOGE(TAG, "Failed to create %s", worker.name);
+        }
+    }
 }
 
 BackgroundTask::~BackgroundTask() {
-    if (background_task_handle_ != nullptr) {
-        vTaskDelete(background_task_handle_);
+    for (auto& worker : workers_) {
+        if (worker.handle != nullptr) {
+            vTaskDelete(worker.handle);
+        }
+        if (worker.task_stack != nullptr) {
+            heap_caps_free(worker.task_stack);
+        }
     }
 }
 
-void BackgroundTask::Schedule(std::function<void()> callback) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (active_tasks_ >= 30) {
-        ESP_LOGW(TAG, "active_tasks_ == %u", active_tasks_.load());
+bool BackgroundTask::Schedule(TaskCallback&& callback, uint8_t stream, BackgroundPolicy policy, const char* label) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stream %= BACKGROUND_TASK_MAX_STREAMS;
+    auto& queue = streams_[stream];
+    // Taken before blocking, so a Cancel while we wait still drops this task
+    uint32_t generation = generation_;
+
+    if (policy == kBackgroundPolicyCoalesce && !queue.empty() && queue.back().coalesce) {
+        queue.back().callback = std::move(callback);
+        queue.back().generation = generation;
+        dropped_tasks_[stream].fetch_add(1, std::memory_order_relaxed);
+        return true;
     }
-    active_tasks_++;
-    main_tasks_.emplace_back([this, cb = std::move(callback)]() {
-        cb();
-        {
-            std::lock_guard<std::mutex> lock(mutex_);
-            active_tasks_--;
-            if (main_tasks_.empty() && active_tasks_ == 0) {
-                condition_variable_.notify_all();
+
+    if (queue.full()) {
+        switch (policy) {
+            case kBackgroundPolicyBlock:
+                condition_variable_.wait(lock, [&queue]() {
+                    return !queue.full();
+                });
+                break;
+            case kBackgroundPolicyDropOldest: {
+                Task oldest;
+                queue.Pop(oldest);
+                active_tasks_--;
+                dropped_tasks_[stream].fetch_add(1, std::memory_order_relaxed);
+                break;
             }
+            default:
+                dropped_tasks_[stream].fetch_add(1, std::memory_order_relaxed);
+                ESP_LOGW(TAG, "Stream %u is full, drop task", stream);
+                return false;
         }
-    });
+    }
+
+    stats_.RecordDepth(active_tasks_);
+    queue.Push(Task{std::move(callback), generation, next_order_++, esp_timer_get_time(), stats_.Register(label),
+        policy == kBackgroundPolicyCoalesce});
+    active_tasks_++;
     condition_variable_.notify_all();
+    return true;
 }
 
 void BackgroundTask::WaitForCompletion() {
     std::unique_lock<std::mutex> lock(mutex_);
     condition_variable_.wait(lock, [this]() {
-        return main_tasks_.empty() && active_tasks_ == 0;
+        return active_tasks_ == 0;
     });
 }
 
-void BackgroundTask::BackgroundTaskLoop() {
-    ESP_LOGI(TAG, "background_task started");
+void BackgroundTask::Cancel() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint32_t cancelled = generation_++;
+    for (auto& queue : streams_) {
+        active_tasks_ -= queue.Clear();
+    }
+    // Wake up the producers blocked on a full stream
+    condition_variable_.notify_all();
+    condition_variable_.wait(lock, [this, cancelled]() {
+        for (auto& worker : workers_) {
+            if (worker.running && (int32_t)(worker.generation - cancelled) <= 0) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+size_t BackgroundTask::dropped_tasks() const {
+    size_t total = 0;
+    for (auto& dropped : dropped_tasks_) {
+        total += dropped.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+size_t BackgroundTask::high_water_mark() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t mark = 0;
+    for (auto& queue : streams_) {
+        mark = std::max(mark, queue.high_water_mark());
+    }
+    return mark;
+}
+
+// Takes the oldest head task of the idle streams homed on this worker, if there is
+// none steals the oldest one of the other streams. Returns the stream or -1.
+int BackgroundTask::TakeTask(Worker& worker, Task& task) {
+    int best = -1;
+    for (int pass = 0; pass < 2 && best < 0; pass++) {
+        for (int stream = 0; stream < BACKGROUND_TASK_MAX_STREAMS; stream++) {
+            bool home = stream % workers_.size() == worker.index;
+            if (home != (pass == 0) || streams_[stream].empty() || (running_streams_ & (1u << stream))) {
+                continue;
+            }
+            if (best < 0 || (int32_t)(streams_[stream].front().order - streams_[best].front().order) < 0) {
+                best = stream;
+            }
+        }
+    }
+    if (best >= 0) {
+        streams_[best].Pop(task);
+    }
+    return best;
+}
+
+void BackgroundTask::BackgroundTaskLoop(Worker& worker) {
+    ESP_LOGI(TAG, "%s started", worker.name);
+    Task task;
+    int stream = -1;
+    std::unique_lock<std::mutex> lock(mutex_);
     while (true) {
-        std::unique_lock<std::mutex> lock(mutex_);
-        condition_variable_.wait(lock, [this]() { return !main_tasks_.empty(); });
-        
-        std::list<std::function<void()>> tasks = std::move(main_tasks_);
+        condition_variable_.wait(lock, [this, &worker, &task, &stream]() {
+            stream = TakeTask(worker, task);
+            return stream >= 0;
+        });
+        running_streams_ |= 1u << stream;
+        worker.running = true;
+        worker.generation = task.generation;
         lock.unlock();
 
-        for (auto& task : tasks) {
-            task();
+        if (task.generation == generation_) {
+            auto start_time = esp_timer_get_time();
+            stats_.RecordWait(task.label, start_time - task.enqueue_time);
+            task.callback();
+            stats_.RecordRun(task.label, esp_timer_get_time() - start_time);
         }
+        task.callback = nullptr;
+
+        lock.lock();
+        running_streams_ &= ~(1u << stream);
+        worker.running = false;
+        active_tasks_--;
+        condition_variable_.notify_all();
     }
 }
@@ -4,30 +4,90 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <mutex>
-#include <list>
+#include <vector>
 #include <condition_variable>
 #include <atomic>
+#include <initializer_list>
 
+#include "task_callback.h"
+#include "task_queue.h"
+#include "task_stats.h"
+
+#define BACKGROUND_TASK_MAX_STREAMS 4
+// Preallocated slots per stream
+#define BACKGROUND_TASK_QUEUE_SIZE 16
+
+// What Schedule does when the stream queue is full
+enum BackgroundPolicy {
+    kBackgroundPolicyBlock,       // Wait for a free slot, never call from a task of the same stream
+    kBackgroundPolicyDropOldest,  // Drop the oldest queued task of the stream, for data that goes stale
+    kBackgroundPolicyDropNewest,  // Drop the task being scheduled
+    kBackgroundPolicyCoalesce     // Replace a queued coalesce task of the stream, for idempotent work
+};
+
+// A pool of worker tasks, one per entry of cores. Tasks of the same stream run one
+// at a time in the order they were scheduled, tasks of different streams may run in
+// parallel. Every stream has a home worker, idle workers steal from the others.
+// Scheduling never allocates, the policy decides what happens when a stream queue is full.
 class BackgroundTask {
 public:
-    BackgroundTask(uint32_t stack_size = 4096 * 2);
+    BackgroundTask(uint32_t stack_size = 4096 * 2, std::initializer_list<BaseType_t> cores = {tskNO_AFFINITY},
+        const char* name = "background");
     ~BackgroundTask();
 
-    void Schedule(std::function<void()> callback);
+    // Returns false if the task was dropped
+    // label names the call site in the task statistics and must be a string literal
+    bool Schedule(TaskCallback&& callback, uint8_t stream = 0, BackgroundPolicy policy = kBackgroundPolicyBlock,
+        const char* label = "default");
     void WaitForCompletion();
+    // Drop every task scheduled before this call without running it,
+    // only waits for those already running, tasks scheduled after it may go on
+    void Cancel();
+
+    // Tasks that were dropped or coalesced away without running, Cancel does not count
+    size_t dropped_tasks() const;
+    inline size_t dropped_tasks(uint8_t stream) const {
+        return dropped_tasks_[stream % BACKGROUND_TASK_MAX_STREAMS].load(std::memory_order_relaxed);
+    }
+    size_t high_water_mark();
+    TaskStats& stats() { return stats_; }
 
 private:
+    struct Task {
+        TaskCallback callback;
+        uint32_t generation = 0;
+        uint32_t order = 0;
+        int64_t enqueue_time = 0;
+        uint8_t label = 0;
+        bool coalesce = false;
+    };
+
+    struct Worker {
+        BackgroundTask* owner;
+        size_t index;
+        // name_<index>, the name is cut short to fit the index
+        char name[configMAX_TASK_NAME_LEN];
+        TaskHandle_t handle = nullptr;
+        // Generation of the task being run, valid while running
+        bool running = false;
+        uint32_t generation = 0;
+        StaticTask_t task_buffer;
+        StackType_t* task_stack = nullptr;
+    };
+
     std::mutex mutex_;
-    std::list<std::function<void()>> main_tasks_;
     std::condition_variable condition_variable_;
-    TaskHandle_t background_task_handle_ = nullptr;
+    std::vector<Worker> workers_;
+    std::vector<TaskQueue<Task>> streams_;
+    uint32_t next_order_ = 0;
+    std::atomic<size_t> dropped_tasks_[BACKGROUND_TASK_MAX_STREAMS] = {};
+    TaskStats stats_;
     std::atomic<size_t> active_tasks_{0};
+    std::atomic<uint32_t> generation_{0};
+    uint32_t running_streams_ = 0;
 
-    TaskHandle_t task_ = nullptr;
-    StaticTask_t task_buffer_;
-    StackType_t* task_stack_ = nullptr;
-
-    void BackgroundTaskLoop();
+    int TakeTask(Worker& worker, Task& task);
+    void BackgroundTaskLoop(Worker& worker);
 };
 
 #endif
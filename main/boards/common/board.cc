@@ -1,5 +1,7 @@
 #include "board.h"
 #include "system_info.h"
+#include "json_writer.h"
+#include "latency_tracer.h"
 #include "display/no_display.h"
 
 #include <esp_log.h>
@@ -59,62 +61,71 @@ std::string Board::GetJson() {
             ],
             "ota": {
                 "label": "ota_0"
+            },
+            "latency": {
+                "sessions": 12,
+                "stages": {
+                    "wake_word_detected": { "count": 4, "p50": 0, "p90": 0, "p99": 0 },
+                    ...
+                }
             }
         }
     */
-    std::string json = "{";
-    json += "\"flash_size\":" + std::to_string(SystemInfo::GetFlashSize()) + ",";
-    json += "\"minimum_free_heap_size\":" + std::to_string(SystemInfo::GetMinimumFreeHeapSize()) + ",";
-    json += "\"mac_address\":\"" + SystemInfo::GetMacAddress() + "\",";
-    json += "\"chip_model_name\":\"" + SystemInfo::GetChipModelName() + "\",";
-    json += "\"chip_info\":{";
+    std::string board_json = GetBoardJson();
+    std::string body;
+    // The partition table and the latency stats make up most of the body
+    JsonWriter json(body, 1536 + board_json.size());
+    json.BeginObject();
+    json.Field("flash_size", SystemInfo::GetFlashSize());
+    json.Field("minimum_free_heap_size", SystemInfo::GetMinimumFreeHeapSize());
+    json.Field("mac_address", SystemInfo::GetMacAddress());
+    json.Field("chip_model_name", SystemInfo::GetChipModelName());
 
     esp_chip_info_t chip_info;
     esp_chip_info(&chip_info);
-    json += "\"model\":" + std::to_string(chip_info.model) + ",";
-    json += "\"cores\":" + std::to_string(chip_info.cores) + ",";
-    json += "\"revision\":" + std::to_string(chip_info.revision) + ",";
-    json += "\"features\":" + std::to_string(chip_info.features);
-    json += "},";
+    json.Key("chip_info").BeginObject();
+    json.Field("model", (int)chip_info.model);
+    json.Field("cores", chip_info.cores);
+    json.Field("revision", chip_info.revision);
+    json.Field("features", chip_info.features);
+    json.EndObject();
 
-    json += "\"application\":{";
     auto app_desc = esp_app_get_description();
-    json += "\"name\":\"" + std::string(app_desc->project_name) + "\",";
-    json += "\"version\":\"" + std::string(app_desc->version) + "\",";
-    json += "\"compile_time\":\"" + std::string(app_desc->date) + "T" + std::string(app_desc->time) + "Z\",";
-    json += "\"idf_version\":\"" + std::string(app_desc->idf_ver) + "\",";
-
+    char compile_time[48];
+    snprintf(compile_time, sizeof(compile_time), "%sT%sZ", app_desc->date, app_desc->time);
     char sha256_str[65];
     for (int i = 0; i < 32; i++) {
         snprintf(sha256_str + i * 2, sizeof(sha256_str) - i * 2, "%02x", app_desc->app_elf_sha256[i]);
     }
-    json += "\"elf_sha256\":\"" + std::string(sha256_str) + "\"";
-    json += "},";
+    json.Key("application").BeginObject();
+    json.Field("name", app_desc->project_name);
+    json.Field("version", app_desc->version);
+    json.Field("compile_time", compile_time);
+    json.Field("idf_version", app_desc->idf_ver);
+    json.Field("elf_sha256", sha256_str);
+    json.EndObject();
 
-    json += "\"partition_table\": [";
+    json.Key("partition_table").BeginArray();
     esp_partition_iterator_t it = esp_partition_find(ESP_PARTITION_TYPE_ANY, ESP_PARTITION_SUBTYPE_ANY, NULL);
     while (it) {
         const esp_partition_t *partition = esp_partition_get(it);
-        json += "{";
-        json += "\"label\":\"" + std::string(partition->label) + "\",";
-        json += "\"type\":" + std::to_string(partition->type) + ",";
-        json += "\"subtype\":" + std::to_string(partition->subtype) + ",";
-        json += "\"address\":" + std::to_string(partition->address) + ",";
-        json += "\"size\":" + std::to_string(partition->size);
-        json += "},";
+        json.BeginObject();
+        json.Field("label", partition->label);
+        json.Field("type", (int)partition->type);
+        json.Field("subtype", (int)partition->subtype);
+        json.Field("address", partition->address);
+        json.Field("size", partition->size);
+        json.EndObject();
         it = esp_partition_next(it);
     }
-    json.pop_back(); // Remove the last comma
-    json += "],";
+    json.EndArray();
 
-    json += "\"ota\":{";
     auto ota_partition = esp_ota_get_running_partition();
-    json += "\"label\":\"" + std::string(ota_partition->label) + "\"";
-    json += "},";
-
-    json += "\"board\":" + GetBoardJson();
+    json.Key("ota").BeginObject().Field("label", ota_partition->label).EndObject();
 
-    // Close the JSON object
-    json += "}";
-    return json;
+    json.Key("board").Raw(board_json);
+    json.Key("latency");
+    LatencyTracer::GetInstance().WriteJson(json);
+    json.EndObject();
+    return body;
 }
\ No newline at end of file
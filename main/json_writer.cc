@@ -0,0 +1,130 @@
+#include "json_writer.h"
+
+#include <charconv>
+#include <cstring>
+
+JsonWriter::JsonWriter(std::string& out, size_t reserve) : out_(out) {
+    out_.clear();
+    if (reserve > out_.capacity()) {
+        out_.reserve(reserve);
+    }
+}
+
+void JsonWriter::BeforeValue() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+    if (depth_ > 0) {
+        uint32_t bit = 1u << (depth_ - 1);
+        if (has_member_ & bit) {
+            out_ += ',';
+        }
+        has_member_ |= bit;
+    }
+}
+
+void JsonWriter::Open(char c) {
+    BeforeValue();
+    out_ += c;
+    if (depth_ < kMaxDepth) {
+        depth_++;
+        has_member_ &= ~(1u << (depth_ - 1));
+    }
+}
+
+void JsonWriter::Close(char c) {
+    if (depth_ > 0) {
+        depth_--;
+    }
+    out_ += c;
+}
+
+JsonWriter& JsonWriter::BeginObject() {
+    Open('{');
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndObject() {
+    Close('}');
+    return *this;
+}
+
+JsonWriter& JsonWriter::BeginArray() {
+    Open('[');
+    return *this;
+}
+
+JsonWriter& JsonWriter::EndArray() {
+    Close(']');
+    return *this;
+}
+
+JsonWriter& JsonWriter::Key(const char* key) {
+    BeforeValue();
+    AppendEscaped(key, strlen(key));
+    out_ += ':';
+    after_key_ = true;
+    return *this;
+}
+
+JsonWriter& JsonWriter::String(const char* value) {
+    return String(value, value != nullptr ? strlen(value) : 0);
+}
+
+JsonWriter& JsonWriter::String(const char* value, size_t length) {
+    BeforeValue();
+    AppendEscaped(value, length);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Int(int64_t value) {
+    BeforeValue();
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out_.append(buffer, result.ptr - buffer);
+    return *this;
+}
+
+JsonWriter& JsonWriter::Bool(bool value) {
+    BeforeValue();
+    out_ += value ? "true" : "false";
+    return *this;
+}
+
+JsonWriter& JsonWriter::Raw(const std::string& value) {
+    BeforeValue();
+    out_ += value;
+    return *this;
+}
+
+// Runs of plain characters are appended in one go, UTF-8 passes through unchanged
+void JsonWriter::AppendEscaped(const char* value, size_t length) {
+    static const char hex_chars[] = "0123456789abcdef";
+    out_ += '"';
+    size_t start = 0;
+    for (size_t i = 0; i < length; i++) {
+        auto c = (uint8_t)value[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out_.append(value + start, i - start);
+        start = i + 1;
+        switch (c) {
+            case '"': out_ += "\\\""; break;
+            case '\\': out_ += "\\\\"; break;
+            case '\n': out_ += "\\n"; break;
+            case '\r': out_ += "\\r"; break;
+            case '\t': out_ += "\\t"; break;
+            case '\b': out_ += "\\b"; break;
+            case '\f': out_ += "\\f"; break;
+            default: {
+                char escaped[] = {'\\', 'u', '0', '0', hex_chars[c >> 4], hex_chars[c & 0xf]};
+                out_.append(escaped, sizeof(escaped));
+                break;
+            }
+        }
+    }
+    out_.append(value + start, length - start);
+    out_ += '"';
+}
@@ -0,0 +1,63 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Appends compact JSON to a string, commas are inserted automatically and strings
+// are escaped. Reserving a size that fits the message keeps it to one allocation.
+//
+//   std::string message;
+//   JsonWriter json(message, 128);
+//   json.BeginObject().Field("type", "listen").Field("state", "start").EndObject();
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out, size_t reserve = 0);
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray();
+    JsonWriter& EndArray();
+    JsonWriter& Key(const char* key);
+
+    JsonWriter& String(const char* value);
+    JsonWriter& String(const std::string& value) { return String(value.c_str(), value.size()); }
+    JsonWriter& String(const char* value, size_t length);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Bool(bool value);
+    // value must already be valid JSON
+    JsonWriter& Raw(const std::string& value);
+
+    template <typename T>
+    JsonWriter& Field(const char* key, const T& value) {
+        Key(key);
+        return Value(value);
+    }
+
+private:
+    static constexpr int kMaxDepth = 32;
+
+    std::string& out_;
+    // Bit d is set once the container at depth d has a member
+    uint32_t has_member_ = 0;
+    int depth_ = 0;
+    bool after_key_ = false;
+
+    void BeforeValue();
+    void Open(char c);
+    void Close(char c);
+    void AppendEscaped(const char* value, size_t length);
+
+    JsonWriter& Value(const char* value) { return String(value); }
+    JsonWriter& Value(const std::string& value) { return String(value); }
+    JsonWriter& Value(bool value) { return Bool(value); }
+    JsonWriter& Value(int value) { return Int(value); }
+    JsonWriter& Value(unsigned int value) { return Int(value); }
+    JsonWriter& Value(long value) { return Int(value); }
+    JsonWriter& Value(unsigned long value) { return Int(value); }
+    JsonWriter& Value(long long value) { return Int(value); }
+    JsonWriter& Value(unsigned long long value) { return Int((int64_t)value); }
+};
+
+#endif // JSON_WRITER_H
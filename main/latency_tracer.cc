@@ -0,0 +1,104 @@
+#include "latency_tracer.h"
+
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <algorithm>
+#include <cstdio>
+
+#define TAG "LatencyTracer"
+
+static const char* const TRACE_POINT_NAMES[] = {
+    "wake_word_detected",
+    "wake_word_encoded",
+    "audio_channel_opened",
+    "first_audio_sent",
+    "tts_start",
+    "first_audio_received",
+    "first_audio_played",
+};
+
+void LatencyTracer::StartSession() {
+    if (active_) {
+        EndSession();
+    }
+    for (auto& mark : marks_) {
+        mark.store(0, std::memory_order_relaxed);
+    }
+    start_time_.store(esp_timer_get_time(), std::memory_order_relaxed);
+    active_ = true;
+}
+
+void LatencyTracer::Mark(LatencyTracePoint point) {
+    if (!active_) {
+        return;
+    }
+    int64_t expected = 0;
+    marks_[point].compare_exchange_strong(expected, esp_timer_get_time(), std::memory_order_relaxed);
+}
+
+bool LatencyTracer::EndSession() {
+    if (!active_.exchange(false)) {
+        return false;
+    }
+
+    auto start_time = start_time_.load(std::memory_order_relaxed);
+    int32_t offsets[kLatencyTracePointCount];
+    char breakdown[256] = "";
+    size_t length = 0;
+    int64_t previous = start_time;
+    for (int i = 0; i < kLatencyTracePointCount; i++) {
+        auto mark = marks_[i].load(std::memory_order_relaxed);
+        offsets[i] = mark == 0 ? -1 : (int32_t)((mark - start_time) / 1000);
+        if (mark != 0) {
+            if (length < sizeof(breakdown)) {
+                length += snprintf(breakdown + length, sizeof(breakdown) - length, " %s=+%lld",
+                    TRACE_POINT_NAMES[i], (mark - previous) / 1000);
+            }
+            previous = mark;
+        }
+    }
+    ESP_LOGI(TAG, "Session latency (ms):%s", breakdown);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < kLatencyTracePointCount; i++) {
+        history_[i][history_index_] = offsets[i];
+        if (history_count_[i] < kHistorySize) {
+            history_count_[i]++;
+        }
+    }
+    history_index_ = (history_index_ + 1) % kHistorySize;
+    sessions_++;
+    return true;
+}
+
+void LatencyTracer::WriteJson(JsonWriter& json) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    json.BeginObject().Field("sessions", sessions_);
+    json.Key("stages").BeginObject();
+    for (int i = 0; i < kLatencyTracePointCount; i++) {
+        int32_t values[kHistorySize];
+        int count = 0;
+        for (int j = 0; j < history_count_[i]; j++) {
+            if (history_[i][j] >= 0) {
+                values[count++] = history_[i][j];
+            }
+        }
+        std::sort(values, values + count);
+        auto percentile = [&](int p) {
+            return count == 0 ? -1 : values[std::min(count - 1, count * p / 100)];
+        };
+        json.Key(TRACE_POINT_NAMES[i]).BeginObject();
+        json.Field("count", count).Field("p50", percentile(50)).Field("p90", percentile(90))
+            .Field("p99", percentile(99));
+        json.EndObject();
+    }
+    json.EndObject().EndObject();
+}
+
+std::string LatencyTracer::GetJson() {
+    std::string body;
+    // About 60 bytes per stage
+    JsonWriter json(body, 64 * kLatencyTracePointCount + 32);
+    WriteJson(json);
+    return body;
+}
@@ -0,0 +1,60 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+#include "json_writer.h"
+
+enum LatencyTracePoint {
+    kLatencyTraceWakeWordDetected,
+    kLatencyTraceWakeWordEncoded,
+    kLatencyTraceAudioChannelOpened,
+    kLatencyTraceFirstAudioSent,
+    kLatencyTraceTtsStart,
+    kLatencyTraceFirstAudioReceived,
+    kLatencyTraceFirstAudioPlayed,
+    kLatencyTracePointCount
+};
+
+// Timestamps the voice pipeline stages of one turn, from the wake word (or the start
+// of listening) to the first TTS sample handed to the codec. Mark only keeps the first
+// hit of each point per session and is safe to call from any task.
+class LatencyTracer {
+public:
+    static LatencyTracer& GetInstance() {
+        static LatencyTracer instance;
+        return instance;
+    }
+    LatencyTracer(const LatencyTracer&) = delete;
+    LatencyTracer& operator=(const LatencyTracer&) = delete;
+
+    void StartSession();
+    // Returns false if there was no session in progress
+    bool EndSession();
+    void Mark(LatencyTracePoint point);
+
+    // Percentiles of every stage, in ms since the session start, over the recent sessions
+    void WriteJson(JsonWriter& json);
+    std::string GetJson();
+
+private:
+    LatencyTracer() = default;
+    ~LatencyTracer() = default;
+
+    static constexpr int kHistorySize = 32;
+
+    std::atomic<bool> active_{false};
+    std::atomic<int64_t> start_time_{0};
+    std::atomic<int64_t> marks_[kLatencyTracePointCount] = {};
+
+    std::mutex mutex_;
+    int32_t history_[kLatencyTracePointCount][kHistorySize];
+    int history_count_[kLatencyTracePointCount] = {};
+    int history_index_ = 0;
+    uint32_t sessions_ = 0;
+};
+
+#endif // LATENCY_TRACER_H
@@ -1,6 +1,8 @@
 #include "mqtt_protocol.h"
+#include "json_writer.h"
 #include "board.h"
 #include "application.h"
+#include "latency_tracer.h"
 #include "settings.h"
 
 #include <esp_log.h>
@@ -11,6 +13,16 @@
 
 #define TAG "MQTT"
 
+#if CONFIG_MQTT_UDP_SIMULATED_LOSS_PERCENT > 0
+#include <esp_random.h>
+
+// Drops audio packets in both directions to try FEC and the bitrate adaptation on a
+// clean network
+static bool SimulatePacketLoss() {
+    return esp_random() % 100 < CONFIG_MQTT_UDP_SIMULATED_LOSS_PERCENT;
+}
+#endif
+
 MqttProtocol::MqttProtocol() {
     event_group_handle_ = xEventGroupCreate();
 
@@ -111,22 +123,34 @@ void MqttProtocol::SendAudio(const std::vector<uint8_t>& data) {
         return;
     }
 
-    std::string nonce(aes_nonce_);
-    *(uint16_t*)&nonce[2] = htons(data.size());
-    *(uint32_t*)&nonce[12] = htonl(++local_sequence_);
-
-    std::string encrypted;
-    encrypted.resize(aes_nonce_.size() + data.size());
-    memcpy(encrypted.data(), nonce.data(), nonce.size());
-
+    if (MQTT_PROTOCOL_NONCE_SIZE + data.size() > send_packet_.capacity()) {
+        ESP_LOGE(TAG, "Audio packet too large: %zu", data.size());
+        return;
+    }
+    // The header goes in front of the payload and doubles as the counter block,
+    // the payload is encrypted straight into the packet
+    send_packet_.resize(MQTT_PROTOCOL_NONCE_SIZE + data.size());
+    auto packet = (uint8_t*)send_packet_.data();
+    memcpy(packet, aes_nonce_.data(), MQTT_PROTOCOL_NONCE_SIZE);
+    *(uint16_t*)&packet[2] = htons(data.size());
+    *(uint32_t*)&packet[12] = htonl(++local_sequence_);
+
+    uint8_t counter[MQTT_PROTOCOL_NONCE_SIZE];
+    memcpy(counter, packet, sizeof(counter));
     size_t nc_off = 0;
     uint8_t stream_block[16] = {0};
-    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, (uint8_t*)nonce.c_str(), stream_block,
-        (uint8_t*)data.data(), (uint8_t*)&encrypted[nonce.size()]) != 0) {
+    if (mbedtls_aes_crypt_ctr(&aes_ctx_, data.size(), &nc_off, counter, stream_block,
+        data.data(), packet + MQTT_PROTOCOL_NONCE_SIZE) != 0) {
         ESP_LOGE(TAG, "Failed to encrypt audio data");
         return;
     }
-    udp_->Send(encrypted);
+#if CONFIG_MQTT_UDP_SIMULATED_LOSS_PERCENT > 0
+    if (SimulatePacketLoss()) {
+        return;
+    }
+#endif
+    udp_->Send(send_packet_);
+    LatencyTracer::GetInstance().Mark(kLatencyTraceFirstAudioSent);
 }
 
 void MqttProtocol::CloseAudioChannel() {
@@ -137,11 +161,11 @@ void MqttProtocol::CloseAudioChannel() {
             udp_ = nullptr;
         }
     }
+    LogPacketStatistics();
 
-    std::string message = "{";
-    message += "\"session_id\":\"" + session_id_ + "\",";
-    message += "\"type\":\"goodbye\"";
-    message += "}";
+    std::string message;
+    JsonWriter json(message, 64);
+    json.BeginObject().Field("session_id", session_id_).Field("type", "goodbye").EndObject();
     SendText(message);
 
     if (on_audio_channel_closed_ != nullptr) {
@@ -160,13 +184,12 @@ bool MqttProtocol::OpenAudioChannel() {
     session_id_ = "";
 
     // 发送 hello 消息申请 UDP 通道
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 3,";
-    message += "\"transport\":\"udp\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
+    std::string message;
+    JsonWriter json(message, 160);
+    json.BeginObject().Field("type", "hello").Field("version", 3).Field("transport", "udp");
+    json.Key("audio_params").BeginObject().Field("format", "opus").Field("sample_rate", 16000)
+        .Field("channels", 1).Field("frame_duration", frame_duration_).EndObject();
+    json.EndObject();
     SendText(message);
 
     // 等待服务器响应
@@ -184,8 +207,10 @@ bool MqttProtocol::OpenAudioChannel() {
         delete udp_;
     }
     udp_ = Board::GetInstance().CreateUdp();
+    send_packet_.reserve(MQTT_PROTOCOL_MAX_AUDIO_PACKET);
+    receive_payload_.reserve(MQTT_PROTOCOL_MAX_AUDIO_PACKET);
     udp_->OnMessage([this](const std::string& data) {
-        if (data.size() < sizeof(aes_nonce_)) {
+        if (data.size() < MQTT_PROTOCOL_NONCE_SIZE) {
             ESP_LOGE(TAG, "Invalid audio packet size: %zu", data.size());
             return;
         }
@@ -193,31 +218,46 @@ bool MqttProtocol::OpenAudioChannel() {
             ESP_LOGE(TAG, "Invalid audio packet type: %x", data[0]);
             return;
         }
+#if CONFIG_MQTT_UDP_SIMULATED_LOSS_PERCENT > 0
+        if (SimulatePacketLoss()) {
+            return;
+        }
+#endif
         uint32_t sequence = ntohl(*(uint32_t*)&data[12]);
-        if (sequence < remote_sequence_) {
-            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, expected: %lu", sequence, remote_sequence_);
+        if (sequence + MQTT_PROTOCOL_REORDER_WINDOW <= remote_sequence_) {
+            ESP_LOGW(TAG, "Received audio packet with old sequence: %lu, newest: %lu", sequence, remote_sequence_);
+            late_packets_++;
             return;
         }
-        if (sequence != remote_sequence_ + 1) {
+        if (sequence <= remote_sequence_) {
+            reordered_packets_++;
+        } else if (sequence != remote_sequence_ + 1) {
             ESP_LOGW(TAG, "Received audio packet with wrong sequence: %lu, expected: %lu", sequence, remote_sequence_ + 1);
         }
-
-        std::vector<uint8_t> decrypted;
-        size_t decrypted_size = data.size() - aes_nonce_.size();
+        received_packets_++;
+
+        // The UDP task is the only user of the receive buffer, it only grows past
+        // its reserved size for oversized packets
+        size_t payload_size = data.size() - MQTT_PROTOCOL_NONCE_SIZE;
+        auto packet = (const uint8_t*)data.data();
+        uint8_t counter[MQTT_PROTOCOL_NONCE_SIZE];
+        memcpy(counter, packet, sizeof(counter));
         size_t nc_off = 0;
         uint8_t stream_block[16] = {0};
-        decrypted.resize(decrypted_size);
-        auto nonce = (uint8_t*)data.data();
-        auto encrypted = (uint8_t*)data.data() + aes_nonce_.size();
-        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, decrypted_size, &nc_off, nonce, stream_block, encrypted, (uint8_t*)decrypted.data());
+        receive_payload_.resize(payload_size);
+        int ret = mbedtls_aes_crypt_ctr(&aes_ctx_, payload_size, &nc_off, counter, stream_block,
+            packet + MQTT_PROTOCOL_NONCE_SIZE, receive_payload_.data());
         if (ret != 0) {
             ESP_LOGE(TAG, "Failed to decrypt audio data, ret: %d", ret);
             return;
         }
         if (on_incoming_audio_ != nullptr) {
-            on_incoming_audio_(std::move(decrypted));
+            on_incoming_audio_(receive_payload_.data(), payload_size, sequence);
+        }
+        UpdatePacketLoss(sequence);
+        if (sequence > remote_sequence_) {
+            remote_sequence_ = sequence;
         }
-        remote_sequence_ = sequence;
     });
 
     udp_->Connect(udp_server_, udp_port_);
@@ -247,6 +287,10 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
         if (sample_rate != NULL) {
             server_sample_rate_ = sample_rate->valueint;
         }
+        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+        if (frame_duration != NULL) {
+            server_frame_duration_ = frame_duration->valueint;
+        }
     }
 
     auto udp = cJSON_GetObjectItem(root, "udp");
@@ -266,9 +310,48 @@ void MqttProtocol::ParseServerHello(const cJSON* root) {
     mbedtls_aes_setkey_enc(&aes_ctx_, (const unsigned char*)DecodeHexString(key).c_str(), 128);
     local_sequence_ = 0;
     remote_sequence_ = 0;
+    loss_window_expected_ = 0;
+    loss_window_received_ = 0;
+    received_packets_ = 0;
+    reordered_packets_ = 0;
+    late_packets_ = 0;
     xEventGroupSetBits(event_group_handle_, MQTT_PROTOCOL_SERVER_HELLO_EVENT);
 }
 
+// Called before remote_sequence_ moves on to sequence
+void MqttProtocol::UpdatePacketLoss(uint32_t sequence) {
+    if (sequence == remote_sequence_) {
+        return; // Duplicate
+    }
+    if (sequence < remote_sequence_) {
+        // Late, the gap it left was already counted as missing
+        if (loss_window_received_ < loss_window_expected_) {
+            loss_window_received_++;
+        }
+        return;
+    }
+    loss_window_expected_ += sequence - remote_sequence_;
+    loss_window_received_++;
+    if (loss_window_expected_ < MQTT_PROTOCOL_LOSS_WINDOW_PACKETS) {
+        return;
+    }
+    int window_loss = (loss_window_expected_ - loss_window_received_) * 100 / loss_window_expected_;
+    packet_loss_percent_ = (packet_loss_percent_ * 3 + window_loss) / 4;
+    loss_window_expected_ = 0;
+    loss_window_received_ = 0;
+}
+
+void MqttProtocol::LogPacketStatistics() {
+    if (remote_sequence_ == 0) {
+        return;
+    }
+    // Late packets arrived but were dropped, so they are not counted as lost
+    uint32_t arrived = received_packets_ + late_packets_;
+    uint32_t lost = remote_sequence_ > arrived ? remote_sequence_ - arrived : 0;
+    ESP_LOGI(TAG, "UDP audio: received %lu, reordered %lu, late %lu, lost %lu",
+        received_packets_, reordered_packets_, late_packets_, lost);
+}
+
 static const char hex_chars[] = "0123456789ABCDEF";
 // 辅助函数，将单个十六进制字符转换为对应的数值
 static inline uint8_t CharToHex(char c) {
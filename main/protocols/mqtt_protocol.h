@@ -12,6 +12,7 @@
 
 #include <functional>
 #include <string>
+#include <vector>
 #include <map>
 #include <mutex>
 
@@ -20,6 +21,17 @@
 
 #define MQTT_PROTOCOL_SERVER_HELLO_EVENT (1 << 0)
 
+// Packets per loss measurement, each window moves the smoothed loss a quarter of the way
+#define MQTT_PROTOCOL_LOSS_WINDOW_PACKETS 50
+// Packets this far behind the newest one are still passed on, the jitter buffer puts them
+// back in order. Older ones are dropped as late.
+#define MQTT_PROTOCOL_REORDER_WINDOW 16
+
+// UDP audio packet: 16 byte header (type, size, sequence) that is also the AES-CTR nonce,
+// then the encrypted Opus frame
+#define MQTT_PROTOCOL_NONCE_SIZE 16
+#define MQTT_PROTOCOL_MAX_AUDIO_PACKET 1500
+
 class MqttProtocol : public Protocol {
 public:
     MqttProtocol();
@@ -49,10 +61,20 @@ private:
     int udp_port_;
     uint32_t local_sequence_;
     uint32_t remote_sequence_;
+    uint32_t loss_window_expected_ = 0;
+    uint32_t loss_window_received_ = 0;
+    uint32_t received_packets_ = 0;
+    uint32_t reordered_packets_ = 0;
+    uint32_t late_packets_ = 0;
+    // Reused for every packet, sized once so the audio path does not allocate
+    std::string send_packet_;
+    std::vector<uint8_t> receive_payload_;
 
     bool StartMqttClient();
     void ParseServerHello(const cJSON* root);
     std::string DecodeHexString(const std::string& hex_string);
+    void UpdatePacketLoss(uint32_t sequence);
+    void LogPacketStatistics();
 
     void SendText(const std::string& text) override;
 };
@@ -1,4 +1,5 @@
 #include "protocol.h"
+#include "json_writer.h"
 
 #include <esp_log.h>
 
@@ -8,7 +9,7 @@ void Protocol::OnIncomingJson(std::function<void(const cJSON* root)> callback) {
     on_incoming_json_ = callback;
 }
 
-void Protocol::OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback) {
+void Protocol::OnIncomingAudio(std::function<void(const uint8_t* data, size_t size, uint32_t sequence)> callback) {
     on_incoming_audio_ = callback;
 }
 
@@ -25,46 +26,56 @@ void Protocol::OnNetworkError(std::function<void(const std::string& message)> ca
 }
 
 void Protocol::SendAbortSpeaking(AbortReason reason) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"abort\"";
+    std::string message;
+    JsonWriter json(message, 128);
+    json.BeginObject().Field("session_id", session_id_).Field("type", "abort");
     if (reason == kAbortReasonWakeWordDetected) {
-        message += ",\"reason\":\"wake_word_detected\"";
+        json.Field("reason", "wake_word_detected");
     }
-    message += "}";
+    json.EndObject();
     SendText(message);
 }
 
 void Protocol::SendWakeWordDetected(const std::string& wake_word) {
-    std::string json = "{\"session_id\":\"" + session_id_ + 
-                      "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wake_word + "\"}";
-    SendText(json);
+    std::string message;
+    JsonWriter json(message, 128 + wake_word.size());
+    json.BeginObject().Field("session_id", session_id_).Field("type", "listen")
+        .Field("state", "detect").Field("text", wake_word).EndObject();
+    SendText(message);
 }
 
 void Protocol::SendStartListening(ListeningMode mode) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\"";
-    message += ",\"type\":\"listen\",\"state\":\"start\"";
+    std::string message;
+    JsonWriter json(message, 128);
+    json.BeginObject().Field("session_id", session_id_).Field("type", "listen").Field("state", "start");
     if (mode == kListeningModeAlwaysOn) {
-        message += ",\"mode\":\"realtime\"";
+        json.Field("mode", "realtime");
     } else if (mode == kListeningModeAutoStop) {
-        message += ",\"mode\":\"auto\"";
+        json.Field("mode", "auto");
     } else {
-        message += ",\"mode\":\"manual\"";
+        json.Field("mode", "manual");
     }
-    message += "}";
+    json.EndObject();
     SendText(message);
 }
 
 void Protocol::SendStopListening() {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"listen\",\"state\":\"stop\"}";
+    std::string message;
+    JsonWriter json(message, 128);
+    json.BeginObject().Field("session_id", session_id_).Field("type", "listen").Field("state", "stop").EndObject();
     SendText(message);
 }
 
 void Protocol::SendIotDescriptors(const std::string& descriptors) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"descriptors\":" + descriptors + "}";
+    std::string message;
+    JsonWriter json(message, 96 + descriptors.size());
+    json.BeginObject().Field("session_id", session_id_).Field("type", "iot").Key("descriptors").Raw(descriptors).EndObject();
     SendText(message);
 }
 
 void Protocol::SendIotStates(const std::string& states) {
-    std::string message = "{\"session_id\":\"" + session_id_ + "\",\"type\":\"iot\",\"states\":" + states + "}";
+    std::string message;
+    JsonWriter json(message, 96 + states.size());
+    json.BeginObject().Field("session_id", session_id_).Field("type", "iot").Key("states").Raw(states).EndObject();
     SendText(message);
 }
-
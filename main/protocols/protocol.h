@@ -4,6 +4,7 @@
 #include <cJSON.h>
 #include <string>
 #include <functional>
+#include <atomic>
 
 struct BinaryProtocol3 {
     uint8_t type;
@@ -30,8 +31,25 @@ public:
     inline int server_sample_rate() const {
         return server_sample_rate_;
     }
+    // Downlink frame duration from the server hello, 60 ms if it does not say
+    inline int server_frame_duration() const {
+        return server_frame_duration_;
+    }
+    // Uplink frame duration announced in the next client hello
+    inline int frame_duration() const {
+        return frame_duration_;
+    }
+    void SetFrameDuration(int frame_duration_ms) {
+        frame_duration_ = frame_duration_ms;
+    }
+    // Smoothed downlink packet loss of the audio channel, 0 if the transport cannot lose packets
+    inline int packet_loss_percent() const {
+        return packet_loss_percent_.load(std::memory_order_relaxed);
+    }
 
-    void OnIncomingAudio(std::function<void(std::vector<uint8_t>&& data)> callback);
+    // sequence increases by one per packet and restarts when the audio channel is opened.
+    // data is only valid during the call, the protocol reuses its receive buffer.
+    void OnIncomingAudio(std::function<void(const uint8_t* data, size_t size, uint32_t sequence)> callback);
     void OnIncomingJson(std::function<void(const cJSON* root)> callback);
     void OnAudioChannelOpened(std::function<void()> callback);
     void OnAudioChannelClosed(std::function<void()> callback);
@@ -50,12 +68,15 @@ public:
 
 protected:
     std::function<void(const cJSON* root)> on_incoming_json_;
-    std::function<void(std::vector<uint8_t>&& data)> on_incoming_audio_;
+    std::function<void(const uint8_t* data, size_t size, uint32_t sequence)> on_incoming_audio_;
     std::function<void()> on_audio_channel_opened_;
     std::function<void()> on_audio_channel_closed_;
     std::function<void(const std::string& message)> on_network_error_;
 
     int server_sample_rate_ = 16000;
+    int server_frame_duration_ = 60;
+    int frame_duration_ = 60;
+    std::atomic<int> packet_loss_percent_{0};
     std::string session_id_;
 
     virtual void SendText(const std::string& text) = 0;
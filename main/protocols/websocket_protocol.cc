@@ -1,7 +1,9 @@
 #include "websocket_protocol.h"
+#include "json_writer.h"
 #include "board.h"
 #include "system_info.h"
 #include "application.h"
+#include "latency_tracer.h"
 
 #include <cstring>
 #include <cJSON.h>
@@ -29,6 +31,7 @@ void WebsocketProtocol::SendAudio(const std::vector<uint8_t>& data) {
     }
 
     websocket_->Send(data.data(), data.size(), true);
+    LatencyTracer::GetInstance().Mark(kLatencyTraceFirstAudioSent);
 }
 
 void WebsocketProtocol::SendText(const std::string& text) {
@@ -55,6 +58,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
         delete websocket_;
     }
 
+    remote_sequence_ = 0;
     std::string url = CONFIG_WEBSOCKET_URL;
     std::string token = "Bearer " + std::string(CONFIG_WEBSOCKET_ACCESS_TOKEN);
     websocket_ = Board::GetInstance().CreateWebSocket();
@@ -65,7 +69,7 @@ bool WebsocketProtocol::OpenAudioChannel() {
     websocket_->OnData([this](const char* data, size_t len, bool binary) {
         if (binary) {
             if (on_incoming_audio_ != nullptr) {
-                on_incoming_audio_(std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len));
+                on_incoming_audio_((const uint8_t*)data, len, ++remote_sequence_);
             }
         } else {
             // Parse JSON data
@@ -103,13 +107,12 @@ bool WebsocketProtocol::OpenAudioChannel() {
 
     // Send hello message to describe the client
     // keys: message type, version, audio_params (format, sample_rate, channels)
-    std::string message = "{";
-    message += "\"type\":\"hello\",";
-    message += "\"version\": 1,";
-    message += "\"transport\":\"websocket\",";
-    message += "\"audio_params\":{";
-    message += "\"format\":\"opus\", \"sample_rate\":16000, \"channels\":1, \"frame_duration\":" + std::to_string(OPUS_FRAME_DURATION_MS);
-    message += "}}";
+    std::string message;
+    JsonWriter json(message, 160);
+    json.BeginObject().Field("type", "hello").Field("version", 1).Field("transport", "websocket");
+    json.Key("audio_params").BeginObject().Field("format", "opus").Field("sample_rate", 16000)
+        .Field("channels", 1).Field("frame_duration", frame_duration_).EndObject();
+    json.EndObject();
     websocket_->Send(message);
 
     // Wait for server hello
@@ -142,6 +145,10 @@ void WebsocketProtocol::ParseServerHello(const cJSON* root) {
         if (sample_rate != NULL) {
             server_sample_rate_ = sample_rate->valueint;
         }
+        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+        if (frame_duration != NULL) {
+            server_frame_duration_ = frame_duration->valueint;
+        }
     }
 
     xEventGroupSetBits(event_group_handle_, WEBSOCKET_PROTOCOL_SERVER_HELLO_EVENT);
@@ -23,6 +23,7 @@ public:
 private:
     EventGroupHandle_t event_group_handle_;
     WebSocket* websocket_ = nullptr;
+    uint32_t remote_sequence_ = 0;
 
     void ParseServerHello(const cJSON* root);
     void SendText(const std::string& text) override;
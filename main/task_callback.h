@@ -0,0 +1,117 @@
+#ifndef TASK_CALLBACK_H
+#define TASK_CALLBACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Enough for this, a couple of references and a moved std::vector
+#define TASK_CALLBACK_INLINE_SIZE 32
+
+// Move-only void() callable for the task queues. Callables up to TASK_CALLBACK_INLINE_SIZE
+// bytes are stored inline, larger ones fall back to the heap and are counted, so
+// heap_allocations() staying flat proves the scheduling layer does not allocate.
+class TaskCallback {
+public:
+    TaskCallback() = default;
+    TaskCallback(std::nullptr_t) {}
+
+    template <typename F, typename Callable = std::decay_t<F>,
+        typename = std::enable_if_t<!std::is_same_v<Callable, TaskCallback>>>
+    TaskCallback(F&& f) {
+        if constexpr (kFitsInline<Callable>) {
+            new (storage_) Callable(std::forward<F>(f));
+            ops_ = &kInlineOps<Callable>;
+        } else {
+            heap_allocations_.fetch_add(1, std::memory_order_relaxed);
+            *(Callable**)storage_ = new Callable(std::forward<F>(f));
+            ops_ = &kHeapOps<Callable>;
+        }
+    }
+
+    TaskCallback(TaskCallback&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    TaskCallback& operator=(TaskCallback&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    TaskCallback& operator=(std::nullptr_t) {
+        Reset();
+        return *this;
+    }
+
+    TaskCallback(const TaskCallback&) = delete;
+    TaskCallback& operator=(const TaskCallback&) = delete;
+
+    ~TaskCallback() {
+        Reset();
+    }
+
+    void operator()() {
+        ops_->invoke(storage_);
+    }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    static uint32_t heap_allocations() { return heap_allocations_.load(std::memory_order_relaxed); }
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* to, void* from);
+        void (*destroy)(void* storage);
+    };
+
+    template <typename Callable>
+    static constexpr bool kFitsInline = sizeof(Callable) <= TASK_CALLBACK_INLINE_SIZE
+        && alignof(Callable) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible_v<Callable>;
+
+    template <typename Callable>
+    static constexpr Ops kInlineOps = {
+        [](void* storage) { (*(Callable*)storage)(); },
+        [](void* to, void* from) {
+            new (to) Callable(std::move(*(Callable*)from));
+            ((Callable*)from)->~Callable();
+        },
+        [](void* storage) { ((Callable*)storage)->~Callable(); },
+    };
+
+    template <typename Callable>
+    static constexpr Ops kHeapOps = {
+        [](void* storage) { (**(Callable**)storage)(); },
+        [](void* to, void* from) { *(Callable**)to = *(Callable**)from; },
+        [](void* storage) { delete *(Callable**)storage; },
+    };
+
+    alignas(std::max_align_t) uint8_t storage_[TASK_CALLBACK_INLINE_SIZE];
+    const Ops* ops_ = nullptr;
+
+    static inline std::atomic<uint32_t> heap_allocations_{0};
+
+    void MoveFrom(TaskCallback& other) {
+        if (other.ops_ != nullptr) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    void Reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+};
+
+#endif // TASK_CALLBACK_H
@@ -0,0 +1,70 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+// Fixed capacity FIFO of move-only elements. The slots are allocated once in the
+// constructor, Push and Pop only move elements in and out. Not thread safe.
+template <typename T>
+class TaskQueue {
+public:
+    explicit TaskQueue(size_t capacity) : capacity_(capacity), slots_(new T[capacity]) {}
+    TaskQueue(TaskQueue&&) = default;
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    // Returns false and leaves item untouched if the queue is full
+    bool Push(T&& item) {
+        if (size_ == capacity_) {
+            return false;
+        }
+        slots_[(head_ + size_) % capacity_] = std::move(item);
+        size_++;
+        if (size_ > high_water_mark_) {
+            high_water_mark_ = size_;
+        }
+        return true;
+    }
+
+    bool Pop(T& item) {
+        if (size_ == 0) {
+            return false;
+        }
+        item = std::move(slots_[head_]);
+        slots_[head_] = T();
+        head_ = (head_ + 1) % capacity_;
+        size_--;
+        return true;
+    }
+
+    T& front() { return slots_[head_]; }
+    T& back() { return slots_[(head_ + size_ - 1) % capacity_]; }
+
+    // Destroys the queued elements in place, returns how many there were
+    size_t Clear() {
+        size_t count = size_;
+        while (size_ > 0) {
+            slots_[head_] = T();
+            head_ = (head_ + 1) % capacity_;
+            size_--;
+        }
+        return count;
+    }
+
+    inline size_t size() const { return size_; }
+    inline bool empty() const { return size_ == 0; }
+    inline bool full() const { return size_ == capacity_; }
+    inline size_t capacity() const { return capacity_; }
+    inline size_t high_water_mark() const { return high_water_mark_; }
+
+private:
+    size_t capacity_;
+    std::unique_ptr<T[]> slots_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+    size_t high_water_mark_ = 0;
+};
+
+#endif // TASK_QUEUE_H
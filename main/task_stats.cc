@@ -0,0 +1,102 @@
+#include "task_stats.h"
+
+#include <esp_log.h>
+#include <cstring>
+#include <algorithm>
+
+#define TAG "TaskStats"
+
+void LogHistogram::Record(uint32_t value) {
+    uint32_t scaled = value >> unit_shift_;
+    int bucket = scaled == 0 ? 0 : 32 - __builtin_clz(scaled);
+    if (bucket >= kBucketCount) {
+        bucket = kBucketCount - 1;
+    }
+    buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    auto max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+void LogHistogram::Reset() {
+    for (auto& bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    max_.store(0, std::memory_order_relaxed);
+}
+
+uint32_t LogHistogram::count() const {
+    uint32_t total = 0;
+    for (auto& bucket : buckets_) {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+uint32_t LogHistogram::Percentile(int p) const {
+    uint32_t total = count();
+    if (total == 0) {
+        return 0;
+    }
+    uint32_t rank = (uint64_t)total * p / 100;
+    uint32_t seen = 0;
+    for (int b = 0; b < kBucketCount - 1; b++) {
+        seen += buckets_[b].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            return std::min((1u << b) << unit_shift_, max());
+        }
+    }
+    // The last bucket is open ended
+    return max();
+}
+
+TaskStats::TaskStats(const char* name) : name_(name) {
+    labels_[TASK_STATS_MAX_LABELS].label = "other";
+}
+
+uint8_t TaskStats::Register(const char* label) {
+    int count = label_count_.load(std::memory_order_relaxed);
+    for (int i = 0; i < count; i++) {
+        if (labels_[i].label == label || strcmp(labels_[i].label, label) == 0) {
+            return i;
+        }
+    }
+    if (count == TASK_STATS_MAX_LABELS) {
+        if (!overflowed_) {
+            overflowed_ = true;
+            ESP_LOGW(TAG, "%s: no slot left for %s, counted as other", name_, label);
+        }
+        return TASK_STATS_MAX_LABELS;
+    }
+    labels_[count].label = label;
+    label_count_.store(count + 1, std::memory_order_release);
+    return count;
+}
+
+void TaskStats::DumpLabel(const LabelStats& stats) const {
+    ESP_LOGI(TAG, "%s/%s: %lu tasks, wait us p50 %lu p90 %lu p99 %lu max %lu, run us p50 %lu p90 %lu p99 %lu max %lu",
+        name_, stats.label, stats.run.count(),
+        stats.wait.Percentile(50), stats.wait.Percentile(90), stats.wait.Percentile(99), stats.wait.max(),
+        stats.run.Percentile(50), stats.run.Percentile(90), stats.run.Percentile(99), stats.run.max());
+}
+
+void TaskStats::Dump() {
+    ESP_LOGI(TAG, "%s: depth p50 %lu p99 %lu max %lu", name_,
+        depth_.Percentile(50), depth_.Percentile(99), depth_.max());
+    int count = label_count_.load(std::memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        DumpLabel(labels_[i]);
+    }
+    if (labels_[TASK_STATS_MAX_LABELS].run.count() > 0) {
+        DumpLabel(labels_[TASK_STATS_MAX_LABELS]);
+    }
+}
+
+void TaskStats::Reset() {
+    depth_.Reset();
+    for (auto& stats : labels_) {
+        stats.wait.Reset();
+        stats.run.Reset();
+    }
+}
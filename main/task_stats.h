@@ -0,0 +1,72 @@
+#ifndef TASK_STATS_H
+#define TASK_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+
+// Named labels per queue, the main loop registers 12. Any further label is counted
+// in one extra slot named "other".
+#define TASK_STATS_MAX_LABELS 16
+
+// Histogram with power of two buckets, bucket b counts the values below (1 << b) << unit_shift.
+// Record is lock free and safe to call from any task.
+class LogHistogram {
+public:
+    static constexpr int kBucketCount = 20;
+
+    explicit LogHistogram(int unit_shift = 0) : unit_shift_(unit_shift) {}
+
+    void Record(uint32_t value);
+    void Reset();
+
+    uint32_t count() const;
+    inline uint32_t max() const { return max_.load(std::memory_order_relaxed); }
+    // Upper bound of the bucket holding the p-th percentile, 0 if empty
+    uint32_t Percentile(int p) const;
+
+private:
+    int unit_shift_;
+    std::atomic<uint32_t> buckets_[kBucketCount] = {};
+    std::atomic<uint32_t> max_{0};
+};
+
+// Wait (enqueue to start) and run time histograms per call site label of one task
+// queue, plus the queue depth seen by every new task. Times are in microseconds.
+class TaskStats {
+public:
+    explicit TaskStats(const char* name);
+    TaskStats(const TaskStats&) = delete;
+    TaskStats& operator=(const TaskStats&) = delete;
+
+    // Labels are expected to be string literals. Not thread safe, the queue calls it
+    // under its own lock. Once all slots are taken new labels share the "other" slot.
+    uint8_t Register(const char* label);
+
+    void RecordDepth(size_t depth) { depth_.Record((uint32_t)depth); }
+    void RecordWait(uint8_t slot, int64_t us) { labels_[slot].wait.Record((uint32_t)us); }
+    void RecordRun(uint8_t slot, int64_t us) { labels_[slot].run.Record((uint32_t)us); }
+    const LogHistogram& run(uint8_t slot) const { return labels_[slot].run; }
+
+    // Logs one line per label
+    void Dump();
+    void Reset();
+
+private:
+    struct LabelStats {
+        const char* label = nullptr;
+        LogHistogram wait{4};
+        LogHistogram run{4};
+    };
+
+    const char* name_;
+    // The slot after the named ones is "other"
+    LabelStats labels_[TASK_STATS_MAX_LABELS + 1];
+    std::atomic<int> label_count_{0};
+    bool overflowed_ = false;
+    LogHistogram depth_;
+
+    void DumpLabel(const LabelStats& stats) const;
+};
+
+#endif // TASK_STATS_H